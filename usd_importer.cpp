@@ -20,6 +20,7 @@
 #include <foundation/math.h>
 #include <foundation/matrix3.h>
 #include <foundation/matrix4.h>
+#include <foundation/minmax.h>
 #include <foundation/pack_float.h>
 #include <foundation/path_tools.h>
 #include <foundation/projection.h>
@@ -29,9 +30,35 @@
 #include <foundation/vector3.h>
 #include <engine/create_geometry.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <latch>
 #include <mutex>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <random>
+#include <set>
+#include <thread>
+
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#endif
 
 #undef CopyFile
 #undef GetObject
@@ -46,6 +73,15 @@
 #include "pxr/usd/usdGeom/metrics.h"
 #include "pxr/usd/usdGeom/camera.h"
 #include "pxr/usd/usdGeom/sphere.h"
+#include "pxr/usd/usdGeom/pointInstancer.h"
+#include "pxr/usd/usdSkel/animQuery.h"
+#include "pxr/usd/usdSkel/binding.h"
+#include "pxr/usd/usdSkel/cache.h"
+#include "pxr/usd/usdSkel/root.h"
+#include "pxr/usd/usdSkel/skeleton.h"
+#include "pxr/usd/usdSkel/skeletonQuery.h"
+#include "pxr/usd/usdSkel/skinningQuery.h"
+#include "pxr/usd/usdSkel/topology.h"
 #include "pxr/usd/usdShade/materialBindingAPI.h"
 #include "pxr/usd/ar/resolver.h"
 #include "pxr/usd/ar/resolverContextBinder.h"
@@ -68,9 +104,314 @@
 #include "json.hpp"
 using nlohmann::json;
 
-std::map<int, hg::NodeRef> idNode_to_NodeRef;
-std::map<std::string, hg::TextureRef> picture_dest_path_to_tex_ref;
-std::map<std::string, std::string> picture_sha1_to_dest_path;
+// Hash table with open addressing and linear probing, the entries are stored in a single array. Entries are never erased one by one, the
+// registries are cleared at once. Pointers to values are invalidated by an insertion.
+template <typename K, typename V, typename H = std::hash<K>> class FlatMap {
+public:
+	V *Find(const K &key) {
+		if (!count)
+			return nullptr;
+		auto &slot = slots[Locate(key)];
+		return slot.used ? &slot.value : nullptr;
+	}
+
+	const V *Find(const K &key) const { return const_cast<FlatMap *>(this)->Find(key); }
+
+	// Insert value unless key is present, returns the value held for key and whether it was inserted.
+	std::pair<V *, bool> Insert(const K &key, const V &value) {
+		if ((count + 1) * 2 > slots.size())
+			Grow();
+
+		auto &slot = slots[Locate(key)];
+		if (slot.used)
+			return {&slot.value, false};
+
+		slot = {key, value, true};
+		++count;
+		return {&slot.value, true};
+	}
+
+	void Set(const K &key, const V &value) {
+		const auto i = Insert(key, value);
+		if (!i.second)
+			*i.first = value;
+	}
+
+	V &operator[](const K &key) { return *Insert(key, V{}).first; }
+
+	size_t size() const { return count; }
+
+	void Clear() {
+		slots.clear();
+		count = 0;
+		shift = 64;
+	}
+
+private:
+	struct Slot {
+		K key{};
+		V value{};
+		bool used{false};
+	};
+
+	// slot holding key or the free slot ending its probe sequence, the hash is spread over the table by Fibonacci hashing
+	size_t Locate(const K &key) const {
+		const size_t mask = slots.size() - 1;
+		for (size_t i = size_t((uint64_t(H{}(key)) * 0x9e3779b97f4a7c15ull) >> shift);; i = (i + 1) & mask)
+			if (!slots[i].used || slots[i].key == key)
+				return i;
+	}
+
+	void Grow() {
+		std::vector<Slot> old(std::max(slots.size() * 2, size_t(16)));
+		std::swap(old, slots);
+
+		shift = 64;
+		for (size_t size = slots.size(); size > 1; size >>= 1)
+			--shift;
+
+		for (auto &slot : old)
+			if (slot.used)
+				slots[Locate(slot.key)] = std::move(slot);
+	}
+
+	std::vector<Slot> slots;
+	size_t count{0};
+	int shift{64};
+};
+
+// FlatMap guarded by a mutex, shared between the scene traversal and the worker threads.
+template <typename K, typename V, typename H = std::hash<K>> class SharedMap {
+public:
+	bool Find(const K &key, V &value) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto found = map.Find(key);
+		if (!found)
+			return false;
+		value = *found;
+		return true;
+	}
+
+	V Get(const K &key) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto found = map.Find(key);
+		return found ? *found : V{};
+	}
+
+	void Set(const K &key, const V &value) {
+		std::lock_guard<std::mutex> lock(mutex);
+		map.Set(key, value);
+	}
+
+	void Clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		map.Clear();
+	}
+
+private:
+	mutable std::mutex mutex;
+	FlatMap<K, V, H> map;
+};
+
+// Fixed set of worker threads consuming a job queue. With less than two workers jobs run inline when queued.
+class WorkerPool {
+public:
+	~WorkerPool() { Stop(); }
+
+	void Start(size_t count) {
+		Stop();
+		quit = false;
+		if (count < 2)
+			return;
+		for (size_t i = 0; i < count; ++i)
+			workers.emplace_back([this]() { Run(); });
+	}
+
+	void Stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		job_cv.notify_all();
+		for (auto &worker : workers)
+			worker.join();
+		workers.clear();
+	}
+
+	void Queue(std::function<void()> job) {
+		if (workers.empty()) {
+			job();
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+			++pending;
+		}
+		job_cv.notify_one();
+	}
+
+	// Block until every queued job has completed.
+	void Wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait(lock, [this]() { return pending == 0; });
+	}
+
+	size_t GetWorkerCount() const { return workers.size(); }
+
+	// Jobs of a group can be waited for without waiting for the other jobs of the pool.
+	class Group {
+	public:
+		void Wait() {
+			std::unique_lock<std::mutex> lock(mutex);
+			done_cv.wait(lock, [this]() { return pending == 0; });
+		}
+
+	private:
+		friend class WorkerPool;
+
+		size_t pending{0};
+		std::mutex mutex;
+		std::condition_variable done_cv;
+	};
+
+	void Queue(std::function<void()> job, Group &group) {
+		{
+			std::lock_guard<std::mutex> lock(group.mutex);
+			++group.pending;
+		}
+		Queue([job = std::move(job), &group]() {
+			job();
+			{
+				std::lock_guard<std::mutex> lock(group.mutex);
+				--group.pending;
+			}
+			group.done_cv.notify_all();
+		});
+	}
+
+private:
+	void Run() {
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				job_cv.wait(lock, [this]() { return quit || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			job();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				--pending;
+			}
+			done_cv.notify_all();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	size_t pending{0};
+	bool quit{false};
+
+	std::mutex mutex;
+	std::condition_variable job_cv, done_cv;
+};
+
+// Timeline of the import phases in Chrome trace event format (open in Perfetto or chrome://tracing). When tracing is off a span only
+// costs a test of the enabled flag.
+class Trace {
+public:
+	struct Event {
+		const char *name;
+		std::string detail;
+		int64_t ts, dur; // microseconds
+		uint32_t tid;
+	};
+
+	void Start() {
+		GetThreadId(); // the calling thread is reported as the main thread
+		origin = std::chrono::steady_clock::now();
+		enabled = true;
+	}
+
+	bool IsEnabled() const { return enabled; }
+
+	int64_t Now() const { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count(); }
+
+	void Add(Event &&event) {
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back(std::move(event));
+	}
+
+	static uint32_t GetThreadId() {
+		static std::atomic<uint32_t> next_tid{0};
+		thread_local const uint32_t tid = next_tid++;
+		return tid;
+	}
+
+	bool Save(const std::string &path) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		json trace_events = json::array();
+		std::set<uint32_t> tids;
+		for (const auto &event : events) {
+			json e = {{"name", event.name}, {"cat", "import"}, {"ph", "X"}, {"ts", event.ts}, {"dur", event.dur}, {"pid", 1}, {"tid", event.tid}};
+			if (!event.detail.empty())
+				e["args"] = {{"prim", event.detail}};
+			trace_events.push_back(std::move(e));
+			tids.insert(event.tid);
+		}
+		for (const auto tid : tids)
+			trace_events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", tid}, {"args", {{"name", tid ? "worker " + std::to_string(tid) : std::string("main")}}}});
+
+		std::ofstream file(path, std::ios::binary);
+		file << json({{"traceEvents", trace_events}, {"displayTimeUnit", "ms"}}).dump();
+		return bool(file);
+	}
+
+private:
+	std::atomic<bool> enabled{false};
+	std::chrono::steady_clock::time_point origin;
+
+	std::mutex mutex;
+	std::vector<Event> events;
+};
+
+static Trace trace;
+
+// Record the time spent in a scope, optionally tagged with the prim being processed.
+class TraceScope {
+public:
+	explicit TraceScope(const char *name_) : name(name_) {
+		if (trace.IsEnabled())
+			start = trace.Now();
+	}
+
+	TraceScope(const char *name_, const pxr::SdfPath &path) : name(name_) {
+		if (trace.IsEnabled()) {
+			detail = path.GetString();
+			start = trace.Now();
+		}
+	}
+
+	~TraceScope() {
+		if (start >= 0)
+			trace.Add({name, std::move(detail), start, trace.Now() - start, Trace::GetThreadId()});
+	}
+
+private:
+	const char *name;
+	std::string detail;
+	int64_t start{-1};
+};
+
+FlatMap<std::string, hg::TextureRef> picture_asset_path_to_tex_ref;
+FlatMap<std::string, hg::TextureRef> picture_sha1_to_tex_ref;
 
 struct AlreadySavedGeo {
 	hg::Object object;
@@ -87,6 +428,7 @@ static std::string Indent(const int indent) {
 }
 
 enum class ImportPolicy { SkipExisting, Overwrite, Rename, SkipAlways };
+enum class SceneFormat { Json, Binary };
 
 struct Config {
 	ImportPolicy import_policy_geometry{ImportPolicy::SkipExisting}, import_policy_material{ImportPolicy::SkipExisting},
@@ -103,11 +445,38 @@ struct Config {
 	int frame_per_second{24};
 
 	bool import_animation{true};
+	bool anim_to_file{false}; // save the animations to their own file instead of embedding them in the scene
+	float anim_tolerance{0.001f}; // keyframe reduction tolerance, in meters (positions), scale units or radians (rotations)
+	SceneFormat scene_format{SceneFormat::Json};
 	bool recalculate_normal{false}, recalculate_tangent{false};
+	bool optimize_mesh{false}; // reorder the geometries for the GPU before saving them
+	bool quantize_geometry{false}; // save a quantized copy of each geometry to a .qgeo file
+	int lod_count{0}; // simplified levels saved next to each geometry
+	float lod_ratio{0.5f}; // triangle count of a level relative to the previous one
+	bool detect_geometry_instances{false}; // share the geometry of the meshes with the same content, up to a rigid transform
+
+	int jobs{1}; // number of worker threads converting geometries
+	int writers{4}; // number of threads writing files, files are written on the import thread if zero
+	size_t write_budget{size_t(256) << 20}; // memory held by the files waiting to be written
+
+	std::string cache_dir; // content cache shared between import runs, disabled if empty
+	std::string trace_path; // timeline of the import phases, disabled if empty
+	bool incremental{false}; // only export the prims, geometries and materials changed since the previous import
+	bool stream_payloads{false}; // load the payloads one at a time during the export
+	bool instancer_arrays{false}; // save the point instancer transforms to .instances files instead of creating a node per instance
+	bool scene_bvh{false}; // save a bounding volume hierarchy of the node bounds next to each scene
+
+	std::vector<pxr::SdfPath> include_paths; // only compose and export these prims, the whole stage if empty
+	std::vector<pxr::SdfPath> exclude_paths; // prims not exported
 
 	std::string finalizer_script;
 };
 
+// Paths returned by GetOutputPath during the import. Their files are written later by the output writer or the worker pools, the skip and
+// rename policies see them as existing so that the outcome does not depend on when the writes happen.
+static std::mutex reserved_output_paths_mutex;
+static std::set<std::string> reserved_output_paths;
+
 static bool GetOutputPath(
 	std::string &path, const std::string &base, const std::string &name, const std::string &prefix, const std::string &ext, ImportPolicy import_policy) {
 	if (base.empty())
@@ -119,6 +488,9 @@ static bool GetOutputPath(
 	// check folder exists and created
 	hg::MkTree(hg::CutFileName(path).c_str());
 
+	std::lock_guard<std::mutex> lock(reserved_output_paths_mutex);
+	const auto exists = [](const std::string &path) { return reserved_output_paths.count(path) || hg::Exists(path.c_str()); };
+
 	switch (import_policy) {
 		default:
 			return false;
@@ -127,21 +499,22 @@ static bool GetOutputPath(
 			return false; // WARNING: Do not move this to the start of the function. The path for the resource is needed even if it is not exported.
 
 		case ImportPolicy::SkipExisting:
-			if (hg::Exists(path.c_str()))
+			if (exists(path))
 				return false;
 			break;
 
 		case ImportPolicy::Overwrite:
-			return true;
+			break;
 
 		case ImportPolicy::Rename:
-			for (auto n = 0; hg::Exists(path.c_str()) && n < 10000; ++n) {
+			for (auto n = 0; exists(path) && n < 10000; ++n) {
 				std::ostringstream ss;
 				ss << base << "/" << filename << "-" << std::setw(4) << std::setfill('0') << n << "." << ext;
 				path = ss.str();
 			}
 			break;
 	}
+	reserved_output_paths.insert(path);
 	return true;
 }
 
@@ -154,759 +527,4218 @@ static std::string MakeRelativeResourceName(const std::string &name, const std::
 	return name;
 }
 
-//
-static hg::Material ExportMaterial(const pxr::UsdShadeShader &shaderUSD, std::set<pxr::TfToken> &uvMapVarname, const pxr::UsdStage &stage,
-	const Config &config, hg::PipelineResources &resources) {
+static const size_t transfer_chunk_size = 4 << 20;
 
-	hg::debug(hg::format("	Exporting material '%1'").arg(shaderUSD.GetPath().GetString()));
+// Content hash of an asset read in fixed size chunks. Assets larger than a chunk hash the list of their chunk hashes so that memory use does
+// not depend on the asset size.
+static std::string ComputeAssetSHA1(const pxr::ArAsset &asset) {
+	const auto size = asset.GetSize();
+	std::vector<char> chunk(std::min(size, transfer_chunk_size));
 
-	static const std::string meta_BC5_text("{\"profiles\": {\"default\": {\"compression\": \"BC5\"}}}");
-	static const std::string meta_BC7_srgb_text("{\"profiles\": {\"default\": {\"compression\": \"BC7\", \"srgb\": 1}}}");
+	if (size <= transfer_chunk_size)
+		return asset.Read(chunk.data(), size, 0) == size ? hg::ComputeSHA1String(chunk.data(), size) : std::string();
 
-	//
-	std::string dst_path;
-	hg::Material mat;
-	std::string shader("core/shader/pbr.hps");
+	std::string chunk_hashes = std::to_string(size);
+	for (size_t offset = 0; offset < size;) {
+		const auto count = asset.Read(chunk.data(), std::min(transfer_chunk_size, size - offset), offset);
+		if (!count)
+			return {};
+		chunk_hashes += hg::ComputeSHA1String(chunk.data(), count);
+		offset += count;
+	}
+	return hg::ComputeSHA1String(chunk_hashes.data(), chunk_hashes.size());
+}
 
-	hg::Vec4 diffuse = {0.5f, 0.5f, 0.5f, 1.f}, orm = {1, 0, 0, 1}, emissive = {0, 0, 0, -1}, specular = {0.5f, 0.5f, 0.5f, 1.f}, ambient = {0, 0, 0, 1};
+#if defined(__linux__)
+// Copy a byte range of a file without going through user memory: share the extents when copying a whole file on a filesystem supporting it
+// (reflink), let the kernel copy otherwise.
+static bool CopyFileRange(int fd_in, size_t offset, size_t size, const std::string &dst_path) {
+	const int fd_out = open(dst_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd_out < 0)
+		return false;
 
-	hg::TextureRef albedoTexture, opacityTexture, occlusionTexture, roughnessTexture, metallicTexture;
+	struct stat st;
+	bool done = offset == 0 && fstat(fd_in, &st) == 0 && size_t(st.st_size) == size && ioctl(fd_out, FICLONE, fd_in) == 0;
+
+	if (!done) {
+		loff_t off_in = offset;
+		size_t left = size;
+		while (left) {
+			const auto count = copy_file_range(fd_in, &off_in, fd_out, nullptr, left, 0);
+			if (count <= 0)
+				break;
+			left -= count;
+		}
+		done = left == 0;
+	}
 
-	// get all inputs
-	for (const auto &input : shaderUSD.GetInputs()) {
-		auto attrs = input.GetValueProducingAttributes();
-		if (attrs.size()) {
-			auto baseNameShaderInput = input.GetAttr().GetBaseName().GetString();
-			auto attr = attrs[0];
-			auto outputShaderName = attr.GetBaseName().GetString();
-			//auto y = attr.GetTypeName().GetCPPTypeName();
+	close(fd_out);
+	return done;
+}
+#endif
 
-			// if there is a real value
-			if (attr.HasAuthoredValue()) {
-				if (baseNameShaderInput == "diffuseColor") {
-					pxr::GfVec3f diffuseUSD;
-					attr.Get(&diffuseUSD);
-					diffuse.x = diffuseUSD.data()[0];
-					diffuse.y = diffuseUSD.data()[1];
-					diffuse.z = diffuseUSD.data()[2];
-				} else if (baseNameShaderInput == "opacity") {
-					attr.Get(&diffuse.w);
-				} else if (baseNameShaderInput == "occlusion") {
-					attr.Get(&orm.x);
-				} else if (baseNameShaderInput == "roughness") {
-					attr.Get(&orm.y);
-				} else if (baseNameShaderInput == "metallic") {
-					attr.Get(&orm.z);
-				} else if (baseNameShaderInput == "emissiveColor") {
-					pxr::GfVec3f emissiveUSD;
-					attr.Get(&emissiveUSD);
-					emissive.x = emissiveUSD.data()[0];
-					emissive.y = emissiveUSD.data()[1];
-					emissive.z = emissiveUSD.data()[2];
-				}
+// Copy an asset through a fixed size buffer.
+static bool StreamAsset(const pxr::ArAsset &asset, const std::string &dst_path) {
+	std::FILE *f = std::fopen(dst_path.c_str(), "wb");
+	if (!f)
+		return false;
 
-			} else {
-				pxr::UsdShadeShader shaderTexture(attr.GetPrim());
-				pxr::ArResolverContextBinder resolverContextBinder(attr.GetPrim().GetStage()->GetPathResolverContext());
+	const auto size = asset.GetSize();
+	std::vector<char> chunk(std::min(size, transfer_chunk_size));
 
-				pxr::TfToken shaderID;
-				shaderTexture.GetShaderId(&shaderID);
+	size_t offset = 0;
+	while (offset < size) {
+		const auto count = asset.Read(chunk.data(), std::min(transfer_chunk_size, size - offset), offset);
+		if (!count || std::fwrite(chunk.data(), 1, count, f) != count)
+			break;
+		offset += count;
+	}
 
-				// it's a texture
-				if (shaderID.GetString() == "UsdUVTexture") { // if (shaderID == pxr::UsdHydraTokens->HwUvTexture_1) { //|| shaderID == pxr::UsdHydraTokens->HwPtexTexture_1) {
-					for (const auto &inputTexture : shaderTexture.GetInputs()) {
-						auto baseNameTextureInput = inputTexture.GetBaseName().GetString();
-						auto attrTexture = inputTexture.GetAttr();
-						if (baseNameTextureInput == "file") {
+	std::fclose(f);
+	return offset == size;
+}
 
-							auto y = attrTexture.GetTypeName().GetCPPTypeName();
+// Copy an asset to the output using the cheapest path available: a plain file is cloned or copied by the system, an entry stored in a
+// package (usdz) is copied by the kernel from the package file or streamed. Loading the whole asset in memory is the last resort.
+static bool TransferAsset(const pxr::ArAsset &asset, const std::string &resolved_path, const std::string &dst_path) {
+	const auto file = asset.GetFileUnsafe(); // file holding the asset and offset of the asset in it, if any
+
+#if defined(__linux__)
+	if (file.first && CopyFileRange(fileno(file.first), file.second, asset.GetSize(), dst_path))
+		return true;
+#else
+	if (file.first && file.second == 0 && !pxr::ArIsPackageRelativePath(resolved_path)) {
+		std::error_code ec;
+		if (std::filesystem::copy_file(resolved_path, dst_path, std::filesystem::copy_options::overwrite_existing, ec))
+			return true;
+	}
+#endif
 
-							// Retrieve the asset file.
-							pxr::SdfAssetPath assetPath;
-							attrTexture.Get(&assetPath);
+	if (StreamAsset(asset, dst_path))
+		return true;
 
-							GetOutputPath(dst_path, config.base_output_path + "/Textures", hg::GetFileName(assetPath.GetAssetPath()), {}, hg::GetFileExtension(assetPath.GetAssetPath()), config.import_policy_texture);
+	hg::warn(hg::format("Streamed copy of %1 failed, copying from memory").arg(resolved_path));
+	if (const auto buffer = asset.GetBuffer()) {
+		auto myfile = std::fstream(dst_path, std::ios::out | std::ios::binary);
+		myfile.write(buffer.get(), asset.GetSize());
+		return bool(myfile);
+	}
+	return false;
+}
 
-							auto texRef = picture_dest_path_to_tex_ref[dst_path];
+// Copy a whole file using the cheapest path available.
+static bool CopyFileFast(const std::string &src_path, const std::string &dst_path) {
+#if defined(__linux__)
+	const int fd_in = open(src_path.c_str(), O_RDONLY);
+	if (fd_in >= 0) {
+		struct stat st;
+		const bool done = fstat(fd_in, &st) == 0 && CopyFileRange(fd_in, 0, size_t(st.st_size), dst_path);
+		close(fd_in);
+		if (done)
+			return true;
+	}
+#endif
+	std::error_code ec;
+	return std::filesystem::copy_file(src_path, dst_path, std::filesystem::copy_options::overwrite_existing, ec);
+}
 
-							// Add the texture to the material.
-							if (baseNameShaderInput == "diffuseColor" && texRef != hg::InvalidTextureRef)
-								albedoTexture = texRef;
-							if (baseNameShaderInput == "opacity" && texRef != hg::InvalidTextureRef)
-								opacityTexture = texRef;
+// Unique temporary path next to a file, used to write it then rename it in place.
+static std::string GetTemporaryPath(const std::string &path) {
+	static std::atomic<uint64_t> counter{0};
+	static const uint64_t seed = (uint64_t(std::random_device{}()) << 32) ^ uint64_t(hg::time_now());
+	std::ostringstream ss;
+	ss << path << "." << std::hex << seed << "-" << counter++ << ".tmp";
+	return ss.str();
+}
 
-							// Generate the ORM (Occlusion, Roughness, Metallic) using the available values.
-							if (baseNameShaderInput == "occlusion" && texRef != hg::InvalidTextureRef)
-								occlusionTexture = texRef;
-							if (baseNameShaderInput == "roughness" && texRef != hg::InvalidTextureRef)
-								roughnessTexture = texRef;
-							if (baseNameShaderInput == "metallic" && texRef != hg::InvalidTextureRef)
-								metallicTexture = texRef;
+// Flush the content of a file, or the entries of a directory, to disk.
+static bool SyncPath(const std::string &path) {
+#if defined(_WIN32)
+	if (hg::IsDir(path.c_str()))
+		return true; // directory entries can't be flushed on Windows
 
-							// Handle the normal texture.
-							if (baseNameShaderInput == "normal" && texRef != hg::InvalidTextureRef) {
-								hg::debug(hg::format("		- uNormalMap: %1").arg(resources.textures.GetName(texRef)));
+	const int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+	if (fd < 0)
+		return false;
+	const bool done = _commit(fd) == 0;
+	_close(fd);
+#else
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	const bool done = fsync(fd) == 0;
+	close(fd);
+#endif
+	return done;
+}
 
-								if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(texRef), {}, "meta", config.import_policy_texture)) {
-									if (std::FILE *f = std::fopen(dst_path.c_str(), "w")) {
-										std::fwrite(meta_BC5_text.data(), sizeof meta_BC5_text[0], meta_BC5_text.size(), f);
-										std::fclose(f);
-									}
-								}
-								mat.textures["uNormalMap"] = {texRef, 2};
-							}
+// Write a file through a temporary file renamed once complete, so that an interrupted write never leaves a truncated file behind. save(path)
+// writes the content to path.
+static bool SaveFileAtomically(const std::string &path, const std::function<bool(const std::string &)> &save) {
+	const auto tmp_path = GetTemporaryPath(path);
 
-							// Handle the emissive texture.
-							if (baseNameShaderInput == "emissiveColor" && texRef != hg::InvalidTextureRef) {
-								hg::debug(hg::format("		- uSelfMap: %1").arg(resources.textures.GetName(texRef)));
+	std::error_code ec;
+	if (save(tmp_path)) {
+		std::filesystem::rename(tmp_path, path, ec);
+		if (!ec)
+			return true;
+	}
+	std::filesystem::remove(tmp_path, ec);
+	return false;
+}
 
-								if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(texRef), {}, "meta", config.import_policy_texture)) {
-									if (std::FILE *f = std::fopen(dst_path.c_str(), "w")) {
-										std::fwrite(meta_BC7_srgb_text.data(), sizeof meta_BC7_srgb_text[0], meta_BC7_srgb_text.size(), f);
-										std::fclose(f);
-									}
-								}
-								mat.textures["uSelfMap"] = {texRef, 4};
-							}
-						} else if (baseNameTextureInput == "st") {
-							// Retrieve the source that is connected to the output.
-							auto sourceUV = inputTexture.GetConnectedSources()[0].source;
+// Content addressed cache of import outputs, shared between import runs and importer processes.
+//
+// objects/<2 first chars of key>/<key>.<ext> holds an output produced from a source whose content hashes to key.
+// index/<2 first chars of key>/<key> holds a small value (eg. the content hash of a source file identified by its path, size and date).
+//
+// Entries are written to a temporary file then renamed in place, so a reader never sees a partial entry and concurrent writers of the same
+// key write the same content. No other synchronization between processes is needed.
+class ContentCache {
+public:
+	bool Open(const std::string &dir) {
+		root = hg::CleanPath(dir);
+		std::error_code ec;
+		std::filesystem::create_directories(root + "/objects", ec);
+		std::filesystem::create_directories(root + "/index", ec);
+		if (ec) {
+			hg::error(hg::format("Can't create cache directory '%1'").arg(root));
+			root.clear();
+		}
+		return IsOpen();
+	}
 
-							// Retrieve the shader where the output is located.
-							pxr::UsdShadeShader shaderUV(sourceUV.GetPrim());
+	bool IsOpen() const { return !root.empty(); }
 
-							// Retrieve the UV input.
-							auto inputUVName = shaderUV.GetInput(pxr::TfToken("varname"));
+	// Get the path of the entry of a key, returns false if there is no such entry.
+	bool Find(const std::string &key, const std::string &ext, std::string &path) {
+		path = GetEntryPath("objects", key, ext);
+		const bool hit = hg::Exists(path.c_str());
+		++(hit ? hits : misses);
+		return hit;
+	}
 
-							// If there's another connected source, update the inputUVName.
-							if (inputUVName.GetConnectedSources().size() > 0) {
-								auto UVNameSource = inputUVName.GetConnectedSources()[0].source;
-								inputUVName = UVNameSource.GetInput(pxr::TfToken("stPrimvarName"));
-							}
+	// Create the entry of a key, write(path) writes the entry content to path.
+	template <typename F> bool Store(const std::string &key, const std::string &ext, F write) {
+		const auto path = GetEntryPath("objects", key, ext);
+		return Commit(path, write);
+	}
 
-							// Retrieve the token reference within the geometry.
-							pxr::TfToken UVName;
-							inputUVName.GetAttr().Get(&UVName);
-							uvMapVarname.insert(UVName);
-						}
-					}
-				}
-			}
-		} else {
-			hg::error(hg::format("!!! Can't find attr for %1").arg(input.GetFullName().GetString()));
-		}
+	bool StoreFile(const std::string &key, const std::string &ext, const std::string &src_path) {
+		return Store(key, ext, [&src_path](const std::string &path) { return CopyFileFast(src_path, path); });
 	}
 
-	// Check if there is an albedo.
-	if (albedoTexture != hg::InvalidTextureRef) {
-		hg::debug(hg::format("		- uBaseOpacityMap: %1").arg(resources.textures.GetName(albedoTexture)));
+	bool GetValue(const std::string &key, std::string &value) const {
+		std::ifstream file(GetEntryPath("index", key, {}), std::ios::binary);
+		if (!file)
+			return false;
+		value.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return !value.empty();
+	}
 
-		json preprocess;
-		if (opacityTexture != hg::InvalidTextureRef) {
-			preprocess = {"preprocess", {{"construct", {"R", "G", "B", {{"path", resources.textures.GetName(opacityTexture)}, {"channel", "A"}}}}}};
-		}
+	bool SetValue(const std::string &key, const std::string &value) {
+		return Commit(GetEntryPath("index", key, {}), [&value](const std::string &path) {
+			std::ofstream file(path, std::ios::binary);
+			file.write(value.data(), value.size());
+			return bool(file);
+		});
+	}
 
-		json meta_albedoTexture_json = {{"profiles", {{"default", {{"compression", "BC7"}, preprocess}}}}};
-		auto meta_albedoTexture = meta_albedoTexture_json.dump();
+	size_t GetHitCount() const { return hits; }
+	size_t GetMissCount() const { return misses; }
 
-		if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(albedoTexture), {}, "meta", config.import_policy_texture)) {
-			if (std::FILE *f = std::fopen(dst_path.c_str(), "w")) {
-				std::fwrite(meta_albedoTexture.data(), sizeof meta_albedoTexture[0], meta_albedoTexture.size(), f);
-				std::fclose(f);
-			}
-		}
+private:
+	std::string GetEntryPath(const char *kind, const std::string &key, const std::string &ext) const {
+		auto path = root + "/" + kind + "/" + key.substr(0, 2) + "/" + key;
+		return ext.empty() ? path : path + "." + ext;
+	}
 
-		mat.textures["uBaseOpacityMap"] = {albedoTexture, 0};
-	}else // Check for cases where there is no albedo texture, but only opacity (e.g., for decals).
-		if (opacityTexture != hg::InvalidTextureRef) { 
-		hg::debug(hg::format("		- uOpacityMap: %1").arg(resources.textures.GetName(opacityTexture)));
+	template <typename F> bool Commit(const std::string &path, F write) {
+		std::error_code ec;
+		std::filesystem::create_directories(hg::CutFileName(path), ec);
+		return SaveFileAtomically(path, write);
+	}
+
+	std::string root;
+	std::atomic<size_t> hits{0}, misses{0};
+};
+
+static ContentCache content_cache;
+
+// Write-behind output, files are written by writer threads while the import goes on. All writes to a path are handled by the same writer in
+// submission order. Submitting a write blocks while the memory held by the pending writes exceeds the budget.
+class OutputWriter {
+public:
+	void Start(int count, size_t memory_budget) {
+		budget = memory_budget;
+		pending_size = 0;
+		failed = false;
+
+		for (int i = 0; i < count; ++i) {
+			lanes.push_back(std::make_unique<Lane>());
+			lanes.back()->thread = std::thread(&OutputWriter::Run, this, lanes.back().get());
+		}
+	}
+
+	void Stop() {
+		for (auto &lane : lanes) {
+			{
+				std::lock_guard<std::mutex> lock(lane->mutex);
+				lane->quit = true;
+			}
+			lane->job_cv.notify_one();
+		}
+
+		for (auto &lane : lanes)
+			lane->thread.join();
+		lanes.clear();
+	}
+
+	size_t GetWriterCount() const { return lanes.size(); }
+
+	// Write a file on a writer thread, save(path) writes the content to path and size is the memory it holds until it runs. Without writer
+	// threads the file is written on the calling thread.
+	void Write(const std::string &path, size_t size, std::function<bool(const std::string &)> save) {
+		if (lanes.empty()) {
+			Save(path, save);
+			return;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			budget_cv.wait(lock, [&]() { return pending_size == 0 || pending_size + size <= budget; });
+			pending_size += size;
+		}
+
+		auto &lane = *lanes[std::hash<std::string>{}(path) % lanes.size()];
+		{
+			std::lock_guard<std::mutex> lock(lane.mutex);
+			lane.jobs.push_back({path, size, std::move(save)});
+		}
+		lane.job_cv.notify_one();
+	}
+
+	void Write(const std::string &path, std::string content) {
+		const auto size = content.size();
+		Write(path, size, [content = std::move(content)](const std::string &tmp_path) {
+			std::ofstream file(tmp_path, std::ios::binary);
+			file.write(content.data(), content.size());
+			file.close();
+			return !file.fail();
+		});
+	}
+
+	// Write a file on the calling thread, it is not flushed to disk before Flush.
+	bool Save(const std::string &path, const std::function<bool(const std::string &)> &save) {
+		const bool saved = SaveFileAtomically(path, save);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (saved) {
+			files.insert(path);
+			dirs.insert(hg::CutFileName(path));
+		} else {
+			hg::error(hg::format("Failed to write '%1'").arg(path));
+			failed = true;
+		}
+		return saved;
+	}
+
+	// Wait for the pending writes then flush the written files followed by the directories holding them, returns false if a write or a flush
+	// failed.
+	bool Flush() {
+		TraceScope trace_scope("Flush");
+
+		for (auto &lane : lanes) {
+			std::unique_lock<std::mutex> lock(lane->mutex);
+			lane->idle_cv.wait(lock, [&]() { return lane->jobs.empty() && !lane->busy; });
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto &file : files)
+			if (!SyncPath(file)) {
+				hg::error(hg::format("Failed to flush '%1'").arg(file));
+				failed = true;
+			}
+		files.clear();
+
+		for (const auto &dir : dirs)
+			SyncPath(dir);
+		dirs.clear();
+
+		return !failed;
+	}
+
+private:
+	struct Job {
+		std::string path;
+		size_t size;
+		std::function<bool(const std::string &)> save;
+	};
+
+	struct Lane {
+		std::deque<Job> jobs;
+		bool busy{false}, quit{false};
+
+		std::mutex mutex;
+		std::condition_variable job_cv, idle_cv;
+		std::thread thread;
+	};
+
+	void Run(Lane *lane) {
+		for (;;) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(lane->mutex);
+				lane->job_cv.wait(lock, [&]() { return lane->quit || !lane->jobs.empty(); });
+				if (lane->jobs.empty())
+					return;
+
+				job = std::move(lane->jobs.front());
+				lane->jobs.pop_front();
+				lane->busy = true;
+			}
+
+			Save(job.path, job.save);
+			job.save = nullptr; // release the content before giving its memory back to the budget
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending_size -= job.size;
+			}
+			budget_cv.notify_all();
+
+			{
+				std::lock_guard<std::mutex> lock(lane->mutex);
+				lane->busy = false;
+			}
+			lane->idle_cv.notify_all();
+		}
+	}
+
+	size_t budget{0}, pending_size{0};
+	bool failed{false};
+	std::set<std::string> files, dirs; // written files and the directories holding them
+
+	std::mutex mutex;
+	std::condition_variable budget_cv;
+
+	std::vector<std::unique_ptr<Lane>> lanes;
+};
+
+static OutputWriter output_writer;
+
+// Identify the importer version and the options a cached geometry depends on. Bump the version when the geometry conversion changes.
+static std::string GetGeometryCacheSalt(const Config &config) {
+	return std::string("geo-5") + (config.recalculate_normal ? " recalculate-normal" : "") + (config.recalculate_tangent ? " recalculate-tangent" : "") +
+		   (config.optimize_mesh ? " optimize-mesh" : "") + (config.quantize_geometry ? " quantize" : "") +
+		   (config.lod_count > 0 ? " lod-" + std::to_string(config.lod_count) + "-" + std::to_string(config.lod_ratio) : "");
+}
+
+// Texture referenced by a material, hashed by the texture workers and written by the output writer.
+struct TextureJob {
+	std::string asset_path; // as authored
+	std::string resolved_path;
+	std::string dst_path, dst_path_meta;
+	bool write{false}, write_meta{false}; // according to the texture policy
+	std::string sha1; // empty if the asset could not be read
+	std::latch hashed{1};
+};
+
+static WorkerPool texture_pool;
+
+// Textures queued to the texture workers by asset path, null if the asset can't be resolved. Only accessed by the traversal thread.
+static std::map<std::string, std::unique_ptr<TextureJob>> texture_jobs;
+
+// Resolve a texture asset, output paths are decided on the traversal thread so that they do not depend on the workers order.
+static bool ResolveTexture(pxr::SdfAssetPath assetPath, const Config &config, TextureJob &job) {
+	// FIXME: Arbitrarily replace <UDIM> with 1001. Currently unsure how to resolve this.
+	if (assetPath.GetResolvedPath() == "") {
+		std::string assetPathToCheck = assetPath.GetAssetPath();
+		hg::replace_all(assetPathToCheck, "<UDIM>", "1001");
+		auto resolvedPath = pxr::ArGetResolver().Resolve(assetPathToCheck);
+		assetPath = pxr::SdfAssetPath(assetPath.GetAssetPath(), resolvedPath);
+	}
+
+	if (assetPath.GetResolvedPath() == "") {
+		hg::error(hg::format("Can't find asset with path %1").arg(assetPath.GetAssetPath()));
+		return false;
+	}
+
+	job.asset_path = assetPath.GetAssetPath();
+	job.resolved_path = assetPath.GetResolvedPath();
+	job.write = GetOutputPath(job.dst_path, config.base_output_path + "/Textures", hg::GetFileName(job.asset_path), {},
+		hg::GetFileExtension(job.asset_path), config.import_policy_texture);
+	job.write_meta = GetOutputPath(
+		job.dst_path_meta, config.base_output_path + "/Textures", hg::CutFilePath(job.asset_path), {}, "meta", config.import_policy_texture);
+	return true;
+}
+
+// Key identifying the current version of a resolved asset from the path, size and modification date of the file holding it.
+static std::string GetAssetStampKey(const std::string &resolved_path) {
+	const auto file_path = pxr::ArIsPackageRelativePath(resolved_path) ? pxr::ArSplitPackageRelativePathOuter(resolved_path).first : resolved_path;
+
+	std::error_code ec;
+	const auto size = std::filesystem::file_size(file_path, ec);
+	if (ec)
+		return {};
+	const auto time = std::filesystem::last_write_time(file_path, ec);
+	if (ec)
+		return {};
+
+	const auto stamp = resolved_path + "|" + std::to_string(size) + "|" + std::to_string(time.time_since_epoch().count());
+	return hg::ComputeSHA1String(stamp.data(), stamp.size());
+}
+
+// Hash the content of a texture.
+static void HashTexture(TextureJob &job) {
+	TraceScope trace_scope("HashTexture");
+
+	// the hash of an unchanged file is taken from the cache index
+	std::string stamp_key;
+	if (content_cache.IsOpen()) {
+		stamp_key = GetAssetStampKey(job.resolved_path);
+		if (!stamp_key.empty() && content_cache.GetValue(stamp_key, job.sha1))
+			stamp_key.clear();
+		else
+			job.sha1.clear();
+	}
+
+	if (job.sha1.empty()) {
+		const auto textureAsset = pxr::ArGetResolver().OpenAsset(pxr::ArResolvedPath(job.resolved_path));
+		if (!textureAsset) {
+			hg::error(hg::format("Can't open asset %1").arg(job.resolved_path));
+			return;
+		}
+
+		job.sha1 = ComputeAssetSHA1(*textureAsset);
+		if (job.sha1.empty()) {
+			hg::error(hg::format("Can't read asset %1").arg(job.resolved_path));
+			return;
+		}
+
+		if (!stamp_key.empty())
+			content_cache.SetValue(stamp_key, job.sha1);
+	}
+}
+
+// Write a texture owning its content to path.
+static bool WriteTexture(const std::string &resolved_path, const std::string &path) {
+	TraceScope trace_scope("WriteTexture");
+
+	const auto textureAsset = pxr::ArGetResolver().OpenAsset(pxr::ArResolvedPath(resolved_path));
+	return textureAsset && TransferAsset(*textureAsset, resolved_path, path);
+}
+
+// Asset paths of the UsdUVTexture shaders connected to the inputs of a shader.
+static std::vector<pxr::SdfAssetPath> GetShaderTextureAssets(const pxr::UsdShadeShader &shaderUSD) {
+	std::vector<pxr::SdfAssetPath> assets;
+	for (const auto &input : shaderUSD.GetInputs()) {
+		auto attrs = input.GetValueProducingAttributes();
+		if (attrs.empty() || attrs[0].HasAuthoredValue())
+			continue;
+
+		pxr::UsdShadeShader shaderTexture(attrs[0].GetPrim());
+
+		pxr::TfToken shaderID;
+		shaderTexture.GetShaderId(&shaderID);
+		if (shaderID.GetString() != "UsdUVTexture")
+			continue;
+
+		pxr::SdfAssetPath assetPath;
+		if (auto file = shaderTexture.GetInput(pxr::TfToken("file")))
+			file.GetAttr().Get(&assetPath);
+
+		if (!assetPath.GetAssetPath().empty())
+			assets.push_back(assetPath);
+	}
+	return assets;
+}
+
+// Queue the hashing of the textures referenced by a material the first time they are seen.
+static void QueueMaterialTextures(const pxr::UsdShadeShader &shaderUSD, const Config &config) {
+	pxr::ArResolverContextBinder resolverContextBinder(shaderUSD.GetPrim().GetStage()->GetPathResolverContext());
+
+	for (const auto &assetPath : GetShaderTextureAssets(shaderUSD)) {
+		// textures are resolved once, even when they can't be found
+		const auto queued = texture_jobs.emplace(assetPath.GetAssetPath(), nullptr);
+		if (!queued.second)
+			continue;
+
+		auto job = std::make_unique<TextureJob>();
+		if (!ResolveTexture(assetPath, config, *job))
+			continue;
+
+		texture_pool.Queue([job = job.get()]() {
+			HashTexture(*job);
+			job->hashed.count_down();
+		});
+		queued.first->second = std::move(job);
+	}
+}
+
+// Import the textures referenced by a material the first time they are seen, textures never bound to a geometry are not imported. Only the
+// textures not hashed yet by the texture workers are waited for, then the first texture of each content in traversal order is kept and
+// written by the output writer while the traversal goes on.
+static void ImportMaterialTextures(const pxr::UsdShadeShader &shaderUSD, const Config &config, hg::PipelineResources &resources) {
+	QueueMaterialTextures(shaderUSD, config);
+
+	for (const auto &assetPath : GetShaderTextureAssets(shaderUSD)) {
+		// textures are imported once, even when they can't be found
+		if (!picture_asset_path_to_tex_ref.Insert(assetPath.GetAssetPath(), hg::InvalidTextureRef).second)
+			continue;
+
+		const auto &job = texture_jobs[assetPath.GetAssetPath()];
+		if (!job)
+			continue;
+
+		job->hashed.wait();
+		if (job->sha1.empty())
+			continue;
+
+		auto &texRef = picture_asset_path_to_tex_ref[job->asset_path];
+
+		// Retrieve the texture reference from the cached SHA1.
+		if (const auto owner = picture_sha1_to_tex_ref.Find(job->sha1)) {
+			texRef = *owner;
+			continue;
+		}
+
+		// Keep the saved texture.
+		uint32_t flags = BGFX_SAMPLER_NONE;
+		std::string dst_rel_path = MakeRelativeResourceName(job->dst_path, config.prj_path, config.prefix);
+		texRef = resources.textures.Add(dst_rel_path.c_str(), {flags, BGFX_INVALID_HANDLE});
+		picture_sha1_to_tex_ref[job->sha1] = texRef;
+
+		// Add ".meta" to ignore this texture from assetc (if it is used by a material, it will be overwritten).
+		if (job->write_meta)
+			output_writer.Write(job->dst_path_meta, "{\"profiles\": {\"default\": {\"type\": \"Ignore\"}}}");
+
+		if (job->write)
+			output_writer.Write(
+				job->dst_path, 0, [resolved_path = job->resolved_path](const std::string &path) { return WriteTexture(resolved_path, path); });
+	}
+}
+
+//
+static hg::Material ExportMaterial(const pxr::UsdShadeShader &shaderUSD, std::set<pxr::TfToken> &uvMapVarname, const pxr::UsdStage &stage,
+	const Config &config, hg::PipelineResources &resources) {
+
+	TraceScope trace_scope("ExportMaterial", shaderUSD.GetPath());
+	hg::debug(hg::format("	Exporting material '%1'").arg(shaderUSD.GetPath().GetString()));
+
+	ImportMaterialTextures(shaderUSD, config, resources);
+
+	static const std::string meta_BC5_text("{\"profiles\": {\"default\": {\"compression\": \"BC5\"}}}");
+	static const std::string meta_BC7_srgb_text("{\"profiles\": {\"default\": {\"compression\": \"BC7\", \"srgb\": 1}}}");
+
+	//
+	std::string dst_path;
+	hg::Material mat;
+	std::string shader("core/shader/pbr.hps");
+
+	hg::Vec4 diffuse = {0.5f, 0.5f, 0.5f, 1.f}, orm = {1, 0, 0, 1}, emissive = {0, 0, 0, -1}, specular = {0.5f, 0.5f, 0.5f, 1.f}, ambient = {0, 0, 0, 1};
+
+	hg::TextureRef albedoTexture, opacityTexture, occlusionTexture, roughnessTexture, metallicTexture;
+
+	// get all inputs
+	for (const auto &input : shaderUSD.GetInputs()) {
+		auto attrs = input.GetValueProducingAttributes();
+		if (attrs.size()) {
+			auto baseNameShaderInput = input.GetAttr().GetBaseName().GetString();
+			auto attr = attrs[0];
+			auto outputShaderName = attr.GetBaseName().GetString();
+			//auto y = attr.GetTypeName().GetCPPTypeName();
+
+			// if there is a real value
+			if (attr.HasAuthoredValue()) {
+				if (baseNameShaderInput == "diffuseColor") {
+					pxr::GfVec3f diffuseUSD;
+					attr.Get(&diffuseUSD);
+					diffuse.x = diffuseUSD.data()[0];
+					diffuse.y = diffuseUSD.data()[1];
+					diffuse.z = diffuseUSD.data()[2];
+				} else if (baseNameShaderInput == "opacity") {
+					attr.Get(&diffuse.w);
+				} else if (baseNameShaderInput == "occlusion") {
+					attr.Get(&orm.x);
+				} else if (baseNameShaderInput == "roughness") {
+					attr.Get(&orm.y);
+				} else if (baseNameShaderInput == "metallic") {
+					attr.Get(&orm.z);
+				} else if (baseNameShaderInput == "emissiveColor") {
+					pxr::GfVec3f emissiveUSD;
+					attr.Get(&emissiveUSD);
+					emissive.x = emissiveUSD.data()[0];
+					emissive.y = emissiveUSD.data()[1];
+					emissive.z = emissiveUSD.data()[2];
+				}
+
+			} else {
+				pxr::UsdShadeShader shaderTexture(attr.GetPrim());
+				pxr::ArResolverContextBinder resolverContextBinder(attr.GetPrim().GetStage()->GetPathResolverContext());
+
+				pxr::TfToken shaderID;
+				shaderTexture.GetShaderId(&shaderID);
+
+				// it's a texture
+				if (shaderID.GetString() == "UsdUVTexture") { // if (shaderID == pxr::UsdHydraTokens->HwUvTexture_1) { //|| shaderID == pxr::UsdHydraTokens->HwPtexTexture_1) {
+					for (const auto &inputTexture : shaderTexture.GetInputs()) {
+						auto baseNameTextureInput = inputTexture.GetBaseName().GetString();
+						auto attrTexture = inputTexture.GetAttr();
+						if (baseNameTextureInput == "file") {
+
+							auto y = attrTexture.GetTypeName().GetCPPTypeName();
+
+							// Retrieve the asset file.
+							pxr::SdfAssetPath assetPath;
+							attrTexture.Get(&assetPath);
+
+							const auto texture = picture_asset_path_to_tex_ref.Find(assetPath.GetAssetPath());
+							auto texRef = texture ? *texture : hg::InvalidTextureRef;
+
+							// Add the texture to the material.
+							if (baseNameShaderInput == "diffuseColor" && texRef != hg::InvalidTextureRef)
+								albedoTexture = texRef;
+							if (baseNameShaderInput == "opacity" && texRef != hg::InvalidTextureRef)
+								opacityTexture = texRef;
+
+							// Generate the ORM (Occlusion, Roughness, Metallic) using the available values.
+							if (baseNameShaderInput == "occlusion" && texRef != hg::InvalidTextureRef)
+								occlusionTexture = texRef;
+							if (baseNameShaderInput == "roughness" && texRef != hg::InvalidTextureRef)
+								roughnessTexture = texRef;
+							if (baseNameShaderInput == "metallic" && texRef != hg::InvalidTextureRef)
+								metallicTexture = texRef;
+
+							// Handle the normal texture.
+							if (baseNameShaderInput == "normal" && texRef != hg::InvalidTextureRef) {
+								hg::debug(hg::format("		- uNormalMap: %1").arg(resources.textures.GetName(texRef)));
+
+								if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(texRef), {}, "meta", config.import_policy_texture)) {
+									output_writer.Write(dst_path, meta_BC5_text);
+								}
+								mat.textures["uNormalMap"] = {texRef, 2};
+							}
+
+							// Handle the emissive texture.
+							if (baseNameShaderInput == "emissiveColor" && texRef != hg::InvalidTextureRef) {
+								hg::debug(hg::format("		- uSelfMap: %1").arg(resources.textures.GetName(texRef)));
+
+								if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(texRef), {}, "meta", config.import_policy_texture)) {
+									output_writer.Write(dst_path, meta_BC7_srgb_text);
+								}
+								mat.textures["uSelfMap"] = {texRef, 4};
+							}
+						} else if (baseNameTextureInput == "st") {
+							// Retrieve the source that is connected to the output.
+							auto sourceUV = inputTexture.GetConnectedSources()[0].source;
+
+							// Retrieve the shader where the output is located.
+							pxr::UsdShadeShader shaderUV(sourceUV.GetPrim());
+
+							// Retrieve the UV input.
+							auto inputUVName = shaderUV.GetInput(pxr::TfToken("varname"));
+
+							// If there's another connected source, update the inputUVName.
+							if (inputUVName.GetConnectedSources().size() > 0) {
+								auto UVNameSource = inputUVName.GetConnectedSources()[0].source;
+								inputUVName = UVNameSource.GetInput(pxr::TfToken("stPrimvarName"));
+							}
+
+							// Retrieve the token reference within the geometry.
+							pxr::TfToken UVName;
+							inputUVName.GetAttr().Get(&UVName);
+							uvMapVarname.insert(UVName);
+						}
+					}
+				}
+			}
+		} else {
+			hg::error(hg::format("!!! Can't find attr for %1").arg(input.GetFullName().GetString()));
+		}
+	}
+
+	// Check if there is an albedo.
+	if (albedoTexture != hg::InvalidTextureRef) {
+		hg::debug(hg::format("		- uBaseOpacityMap: %1").arg(resources.textures.GetName(albedoTexture)));
+
+		json preprocess;
+		if (opacityTexture != hg::InvalidTextureRef) {
+			preprocess = {"preprocess", {{"construct", {"R", "G", "B", {{"path", resources.textures.GetName(opacityTexture)}, {"channel", "A"}}}}}};
+		}
+
+		json meta_albedoTexture_json = {{"profiles", {{"default", {{"compression", "BC7"}, preprocess}}}}};
+		auto meta_albedoTexture = meta_albedoTexture_json.dump();
+
+		if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(albedoTexture), {}, "meta", config.import_policy_texture)) {
+			output_writer.Write(dst_path, meta_albedoTexture);
+		}
+
+		mat.textures["uBaseOpacityMap"] = {albedoTexture, 0};
+	}else // Check for cases where there is no albedo texture, but only opacity (e.g., for decals).
+		if (opacityTexture != hg::InvalidTextureRef) { 
+		hg::debug(hg::format("		- uOpacityMap: %1").arg(resources.textures.GetName(opacityTexture)));
+
+		json meta_opacityTexture_json = {{"profiles", {{"default", {{"compression", "BC7"}, {"preprocess", {{"construct", {(int)(diffuse.x * 255), (int)(diffuse.y * 255), (int)(diffuse.z * 255), {{"path", resources.textures.GetName(opacityTexture)}, {"channel", "A"}}}}}}}}}}};
+		auto meta_opacityTexture = meta_opacityTexture_json.dump();
+
+		if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(opacityTexture), {}, "meta", config.import_policy_texture)) {
+			output_writer.Write(dst_path, meta_opacityTexture);
+		}
+
+		mat.textures["uBaseOpacityMap"] = {opacityTexture, 0};
+	}
+
+	// Check if there is an ORM (Occlusion, Roughness, Metallic).
+	if (occlusionTexture != hg::InvalidTextureRef || roughnessTexture != hg::InvalidTextureRef || metallicTexture != hg::InvalidTextureRef) {
+		json preprocess;
+
+		auto metallicRoughnessTexture =
+			occlusionTexture != hg::InvalidTextureRef ? occlusionTexture : (roughnessTexture != hg::InvalidTextureRef ? roughnessTexture : metallicTexture);
+
+		if (occlusionTexture != roughnessTexture || roughnessTexture != metallicTexture || metallicTexture != occlusionTexture) {
+			json occlusionJSON;
+			if (occlusionTexture != hg::InvalidTextureRef)
+				occlusionJSON = resources.textures.GetName(occlusionTexture);
+			else
+				occlusionJSON = (int)orm.x * 255;
+			json roughnessJSON;
+			if (roughnessTexture != hg::InvalidTextureRef)
+				roughnessJSON = resources.textures.GetName(roughnessTexture);
+			else
+				roughnessJSON = (int)orm.y * 255;
+			json metallicJSON;
+			if (metallicTexture != hg::InvalidTextureRef)
+				metallicJSON = resources.textures.GetName(metallicTexture);
+			else
+				metallicJSON = (int)orm.z * 255;
+			preprocess = {"preprocess", {{"construct", {occlusionJSON, roughnessJSON, metallicJSON}}}};
+		}
+
+		json meta_occlusionTexture_json = {{"profiles", {{"default", {{"compression", "BC7"}, preprocess}}}}};
+		auto meta_occlusionTexture = meta_occlusionTexture_json.dump();
+
+		if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(metallicRoughnessTexture), {}, "meta", config.import_policy_texture)) {
+			output_writer.Write(dst_path, meta_occlusionTexture);
+		}
+		mat.textures["uOcclusionRoughnessMetalnessMap"] = {metallicRoughnessTexture, 1};
+	}
+
+	mat.values["uBaseOpacityColor"] = {bgfx::UniformType::Vec4, {diffuse.x, diffuse.y, diffuse.z, diffuse.w}};
+	mat.values["uOcclusionRoughnessMetalnessColor"] = {bgfx::UniformType::Vec4, {orm.x, orm.y, orm.z, orm.w}};
+	mat.values["uSelfColor"] = {bgfx::UniformType::Vec4, {emissive.x, emissive.y, emissive.z, emissive.w}};
+
+	if (opacityTexture != hg::InvalidTextureRef || diffuse.w < 1)
+		SetMaterialBlendMode(mat, hg::BM_Alpha);
+
+	if (!config.shader.empty())
+		shader = config.shader; // Use the overridden shader if provided.
+
+	hg::debug(hg::format("		- Using pipeline shader '%1'").arg(shader));
+	mat.program = resources.programs.Add(shader.c_str(), {});
+
+	// FinalizeMaterial(mat, fbx_material->GetName(), geo_name);
+	return mat;
+}
+
+#define __PolIndex (pol_index[p] + v)
+#define __PolRemapIndex (pol_index[p] + (geo.pol[p].vtx_count - 1 - v))
+
+// How a primvar is expanded to the polygon-vertices, the authored interpolation is validated against the primvar size.
+enum class PrimvarMapping { FaceVarying, Vertex, Uniform, Constant, Invalid };
+
+static PrimvarMapping GetPrimvarMapping(const pxr::TfToken &interpolation, size_t size, size_t point_count, size_t face_count, size_t corner_count) {
+	if (interpolation == pxr::UsdGeomTokens->faceVarying && size == corner_count)
+		return PrimvarMapping::FaceVarying;
+	if ((interpolation == pxr::UsdGeomTokens->vertex || interpolation == pxr::UsdGeomTokens->varying) && size == point_count)
+		return PrimvarMapping::Vertex;
+	if (interpolation == pxr::UsdGeomTokens->uniform && size == face_count)
+		return PrimvarMapping::Uniform;
+	if (interpolation == pxr::UsdGeomTokens->constant && size == 1)
+		return PrimvarMapping::Constant;
+
+	// interpolation missing or not matching the data, guess from the size
+	if (size == corner_count)
+		return PrimvarMapping::FaceVarying;
+	if (size == point_count)
+		return PrimvarMapping::Vertex;
+	if (size == face_count)
+		return PrimvarMapping::Uniform;
+	if (size == 1)
+		return PrimvarMapping::Constant;
+	return PrimvarMapping::Invalid;
+}
+
+// Expand a primvar to the polygon-vertices. Each branch is a single gather loop so that the compiler can vectorize the conversion.
+template <typename S, typename D, typename F>
+static void ExpandPrimvar(const S *src, PrimvarMapping mapping, const uint32_t *corner_fv, const uint32_t *corner_vtx, const uint32_t *corner_face, D *dst,
+	size_t corner_count, F convert) {
+	switch (mapping) {
+		case PrimvarMapping::FaceVarying:
+			for (size_t c = 0; c < corner_count; ++c)
+				dst[c] = convert(src[corner_fv[c]]);
+			break;
+		case PrimvarMapping::Vertex:
+			for (size_t c = 0; c < corner_count; ++c)
+				dst[c] = convert(src[corner_vtx[c]]);
+			break;
+		case PrimvarMapping::Uniform:
+			for (size_t c = 0; c < corner_count; ++c)
+				dst[c] = convert(src[corner_face[c]]);
+			break;
+		case PrimvarMapping::Constant: {
+			const auto v = convert(src[0]);
+			for (size_t c = 0; c < corner_count; ++c)
+				dst[c] = v;
+		} break;
+		default:
+			break;
+	}
+}
+
+// Skinning of a mesh by a UsdSkel skeleton, found by the traversal when its SkelRoot is exported. The map of the bindings is only accessed by
+// the traversal, a geometry job holds the binding of its mesh.
+struct SkinBinding {
+	pxr::UsdSkelSkinningQuery skinning;
+	pxr::SdfPath skeleton;
+	std::vector<int> joint_remap; // skeleton joint of each joint of the skinning order, -1 if the skeleton has no such joint
+	std::vector<hg::Mat4> bind_pose; // inverse of the joint bind transform in geometry space, for each joint of the skeleton
+};
+
+static pxr::UsdSkelCache skel_cache;
+static FlatMap<pxr::SdfPath, std::shared_ptr<const SkinBinding>, pxr::SdfPath::Hash> skin_bindings; // by skinned mesh
+
+// Joints and skinned objects of each scene being exported, the bones of an object are set once the joints of its skeleton are created.
+struct SceneSkeletons {
+	std::map<pxr::SdfPath, std::vector<hg::NodeRef>> joints; // by skeleton, in skeleton joint order
+	std::vector<std::pair<hg::Object, pxr::SdfPath>> objects; // skinned objects and their skeleton
+};
+
+std::map<const hg::Scene *, SceneSkeletons> scene_skeletons;
+
+static std::shared_ptr<const SkinBinding> FindSkinBinding(const pxr::UsdPrim &p) {
+	const auto *skin = skin_bindings.Find(p.GetTypeName() == "GeomSubset" ? p.GetPath().GetParentPath() : p.GetPath());
+	return skin ? *skin : nullptr;
+}
+
+// Source data of a geometry conversion, read once from the stage.
+struct MeshSource {
+	pxr::SdfPath path;
+	pxr::VtArray<pxr::GfVec3f> points;
+	pxr::VtArray<pxr::GfVec3f> extent; // bounds of the points if authored
+	pxr::VtArray<pxr::GfVec3f> normals;
+	pxr::TfToken normalsInterpolation;
+	std::vector<pxr::VtArray<pxr::GfVec2f>> uvs;
+	std::vector<pxr::TfToken> uvsInterpolation;
+	pxr::VtArray<int> faceVertexCounts;
+	pxr::VtArray<int> faceVertexIndices;
+	pxr::VtArray<int> faceSubsetIndices;
+	pxr::VtArray<int> holeIndices; // faces not rendered
+	std::vector<hg::Geometry::Skin> skin; // per point, empty if the mesh is not skinned
+	std::vector<hg::Mat4> bindPose;
+	bool isSubset{false};
+	float metersPerUnit{1.f};
+};
+
+static void ReadMeshSource(
+	const pxr::UsdGeomMesh &geoMesh, const pxr::UsdGeomSubset *geoMeshSubSet, const std::set<pxr::TfToken> &uvMapVarname, MeshSource &mesh) {
+	mesh.path = geoMeshSubSet ? geoMeshSubSet->GetPath() : geoMesh.GetPath();
+
+	// All arrays are read once then only accessed through their const data, indexing a non-const VtArray checks for copy-on-write on each access.
+	geoMesh.GetPointsAttr().Get(&mesh.points);
+	geoMesh.GetExtentAttr().Get(&mesh.extent);
+	geoMesh.GetNormalsAttr().Get(&mesh.normals);
+	mesh.normalsInterpolation = geoMesh.GetNormalsInterpolation();
+	geoMesh.GetFaceVertexCountsAttr().Get(&mesh.faceVertexCounts);
+	geoMesh.GetFaceVertexIndicesAttr().Get(&mesh.faceVertexIndices);
+	geoMesh.GetHoleIndicesAttr().Get(&mesh.holeIndices);
+
+	// uv texcoord from blender (TODO test from other sources)
+	for (const auto &UVToken : uvMapVarname) {
+		auto UVPrim = pxr::UsdGeomPrimvar(geoMesh.GetPrim().GetAttribute(pxr::TfToken("primvars:"+UVToken.GetString())));
+		if (UVPrim.HasValue()) {
+			mesh.uvs.resize(mesh.uvs.size()+1);			
+			UVPrim.Get(&mesh.uvs.back());
+			mesh.uvsInterpolation.push_back(UVPrim.GetInterpolation());
+		}
+	}
+	// If a geometry subset exists, retrieve its indices.
+	if (geoMeshSubSet) {
+		geoMeshSubSet->GetIndicesAttr().Get(&mesh.faceSubsetIndices);
+		mesh.isSubset = true;
+	}
+
+	// global scale from usd to be in meter
+	mesh.metersPerUnit = float(pxr::UsdGeomGetStageMetersPerUnit(geoMesh.GetPrim().GetStage()));
+}
+
+// Keep the 4 largest influences of a point, renormalized and quantized so that the weights sum to 255. Joints are remapped to the
+// skeleton order.
+static hg::Geometry::Skin CompactJointInfluences(const int *indices, const float *weights, int count, const std::vector<int> &joint_remap) {
+	std::array<std::pair<float, int>, 4> top{}; // weight and skeleton joint, by decreasing weight
+	for (int i = 0; i < count; ++i) {
+		const float w = weights[i];
+		if (!(w > top[3].first) || indices[i] < 0 || size_t(indices[i]) >= joint_remap.size() || joint_remap[indices[i]] < 0)
+			continue;
+
+		int k = 3;
+		for (; k > 0 && w > top[k - 1].first; --k)
+			top[k] = top[k - 1];
+		top[k] = {w, joint_remap[indices[i]]};
+	}
+
+	hg::Geometry::Skin skin{};
+	const float sum = top[0].first + top[1].first + top[2].first + top[3].first;
+	if (sum <= 0.f) { // not weighted, follow the first joint
+		skin.weight[0] = 255;
+		return skin;
+	}
+
+	int total = 0;
+	for (int k = 0; k < 4; ++k) {
+		skin.index[k] = uint16_t(top[k].second);
+		skin.weight[k] = uint8_t(std::lround(top[k].first / sum * 255.f));
+		total += skin.weight[k];
+	}
+	skin.weight[0] = uint8_t(skin.weight[0] + 255 - total); // rounding residue goes to the largest influence
+	return skin;
+}
+
+static void ReadMeshSkin(const SkinBinding &binding, MeshSource &mesh) {
+	TraceScope trace_scope("ReadMeshSkin", mesh.path);
+
+	pxr::VtIntArray indices;
+	pxr::VtFloatArray weights;
+	if (!binding.skinning.ComputeJointInfluences(&indices, &weights))
+		return;
+
+	const int per_point = binding.skinning.GetNumInfluencesPerComponent();
+	const bool rigid = binding.skinning.IsRigidlyDeformed(); // a single set of influences for all points
+	const size_t point_count = mesh.points.size(), needed = size_t(per_point) * (rigid ? 1 : point_count);
+	if (per_point <= 0 || indices.size() < needed || weights.size() < needed) {
+		hg::warn(hg::format("Unexpected joint influence count %1 on '%2'").arg(indices.size()).arg(mesh.path.GetString()));
+		return;
+	}
+
+	mesh.skin.resize(point_count);
+	for (size_t i = 0; i < point_count; ++i) {
+		const size_t o = rigid ? 0 : i * per_point;
+		mesh.skin[i] = rigid && i ? mesh.skin[0] : CompactJointInfluences(indices.cdata() + o, weights.cdata() + o, per_point, binding.joint_remap);
+	}
+	mesh.bindPose = binding.bind_pose;
+}
+
+static void ReadMeshSource(const pxr::UsdPrim &p, const std::set<pxr::TfToken> &uvMapVarname, const SkinBinding *skin, MeshSource &mesh) {
+	TraceScope trace_scope("ReadMeshSource", p.GetPath());
+	if (p.GetTypeName() == "GeomSubset") {
+		pxr::UsdGeomSubset subset(p);
+		ReadMeshSource(pxr::UsdGeomMesh(p.GetParent()), &subset, uvMapVarname, mesh);
+	} else {
+		ReadMeshSource(pxr::UsdGeomMesh(p), nullptr, uvMapVarname, mesh);
+	}
+
+	if (skin)
+		ReadMeshSkin(*skin, mesh);
+}
+
+// Split polygons into triangles, by ear clipping in the plane best fitting the polygon (Newell normal). Polygons left without an ear
+// (self-intersecting, degenerate or numerically ambiguous) are finished by clipping their most convex vertex so that a polygon of n
+// vertices always gives n - 2 triangles. Polygons with holes bridged to their outer loop are handled as their bridge vertices coincide.
+class PolygonTriangulator {
+public:
+	// Append the triangles of a polygon to out, as indices in the polygon vertices. Winding follows the polygon.
+	void Triangulate(const std::vector<hg::Vec3> &points, std::vector<uint32_t> &out) {
+		const size_t n = points.size();
+		if (n < 3)
+			return;
+		if (n == 3) {
+			out.insert(out.end(), {0, 1, 2});
+			return;
+		}
+
+		if (!Project(points)) { // no area, any triangulation is as good
+			for (uint32_t i = 1; i + 1 < n; ++i)
+				out.insert(out.end(), {0, i, i + 1});
+			return;
+		}
+
+		if (n == 4 && IsConvex(0, 3, 1) && IsConvex(1, 0, 2) && IsConvex(2, 1, 3) && IsConvex(3, 2, 0)) {
+			// split a convex quad along its shortest diagonal
+			if (hg::Len2(points[2] - points[0]) <= hg::Len2(points[3] - points[1]))
+				out.insert(out.end(), {0, 1, 2, 0, 2, 3});
+			else
+				out.insert(out.end(), {0, 1, 3, 1, 2, 3});
+			return;
+		}
+
+		prev.resize(n);
+		next.resize(n);
+		for (uint32_t i = 0; i < n; ++i) {
+			prev[i] = i ? i - 1 : uint32_t(n - 1);
+			next[i] = i + 1 < n ? i + 1 : 0;
+		}
+
+		uint32_t i = 0;
+		for (size_t remaining = n, tested = 0; remaining > 3;) {
+			if (IsEar(i)) {
+				out.insert(out.end(), {prev[i], i, next[i]});
+				i = Clip(i);
+				--remaining;
+				tested = 0;
+			} else if (++tested < remaining) {
+				i = next[i];
+			} else {
+				i = Clip(MostConvex(i, remaining));
+				--remaining;
+				tested = 0;
+			}
+		}
+		out.insert(out.end(), {prev[i], i, next[i]});
+	}
+
+private:
+	bool Project(const std::vector<hg::Vec3> &points) {
+		hg::Vec3 normal(0.f, 0.f, 0.f);
+		for (size_t i = 0, n = points.size(); i < n; ++i) {
+			const auto &a = points[i], &b = points[(i + 1) % n];
+			normal.x += (a.y - b.y) * (a.z + b.z);
+			normal.y += (a.z - b.z) * (a.x + b.x);
+			normal.z += (a.x - b.x) * (a.y + b.y);
+		}
+
+		const float ax = std::abs(normal.x), ay = std::abs(normal.y), az = std::abs(normal.z);
+		if (ax + ay + az <= 0.f)
+			return false;
+
+		// drop the dominant axis of the normal, the projected polygon is counterclockwise
+		x.resize(points.size());
+		y.resize(points.size());
+		for (size_t i = 0; i < points.size(); ++i) {
+			const auto &p = points[i];
+			if (ax >= ay && ax >= az) {
+				x[i] = p.y;
+				y[i] = normal.x > 0.f ? p.z : -p.z;
+			} else if (ay >= az) {
+				x[i] = p.z;
+				y[i] = normal.y > 0.f ? p.x : -p.x;
+			} else {
+				x[i] = p.x;
+				y[i] = normal.z > 0.f ? p.y : -p.y;
+			}
+		}
+		return true;
+	}
+
+	float Cross(uint32_t a, uint32_t b, uint32_t c) const { return (x[b] - x[a]) * (y[c] - y[a]) - (y[b] - y[a]) * (x[c] - x[a]); }
+	bool IsConvex(uint32_t i, uint32_t p, uint32_t n) const { return Cross(p, i, n) > 0.f; }
+	bool SamePoint(uint32_t a, uint32_t b) const { return x[a] == x[b] && y[a] == y[b]; }
+
+	bool IsEar(uint32_t i) const {
+		const auto p = prev[i], n = next[i];
+		if (!IsConvex(i, p, n))
+			return false;
+
+		// no other vertex inside or on the ear, vertices coinciding with its corners are bridges to a hole
+		for (auto j = next[n]; j != p; j = next[j]) {
+			if (SamePoint(j, p) || SamePoint(j, i) || SamePoint(j, n))
+				continue;
+			if (Cross(p, i, j) >= 0.f && Cross(i, n, j) >= 0.f && Cross(n, p, j) >= 0.f)
+				return false;
+		}
+		return true;
+	}
+
+	uint32_t MostConvex(uint32_t start, size_t remaining) const {
+		auto best = start;
+		float best_cross = -std::numeric_limits<float>::max();
+		auto i = start;
+		for (size_t k = 0; k < remaining; ++k, i = next[i]) {
+			const float c = Cross(prev[i], i, next[i]);
+			if (c > best_cross) {
+				best_cross = c;
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	// remove a vertex, returns the vertex to test next
+	uint32_t Clip(uint32_t i) {
+		const auto p = prev[i], n = next[i];
+		next[p] = n;
+		prev[n] = p;
+		return p;
+	}
+
+	std::vector<float> x, y;
+	std::vector<uint32_t> prev, next;
+};
+
+static void ExportGeometry(const MeshSource &mesh, hg::Geometry &geo) {
+	TraceScope trace_scope("ExportGeometry", mesh.path);
+
+	const auto &points = mesh.points;
+	const auto &normals = mesh.normals;
+	const auto &uvs = mesh.uvs;
+	const auto &faceVertexCounts = mesh.faceVertexCounts;
+	const auto &faceVertexIndices = mesh.faceVertexIndices;
+	const auto &faceSubsetIndices = mesh.faceSubsetIndices;
+
+	hg::debug(hg::format("	%1: geoMesh.points = %2\n").arg(__func__).arg(points.size()));
+	hg::debug(hg::format("		# of normals = %1\n").arg(normals.size()));
+	hg::debug(hg::format("		# of faceVertexCounts = %1\n").arg(faceVertexCounts.size()));
+	hg::debug(hg::format("		# of faceVertexIndices = %1\n").arg(faceVertexIndices.size()));
+	hg::debug(hg::format("		# of  nb uv = %1\n").arg(uvs.size()));
+	hg::debug(hg::format("		# of faceSubsetIndices = %1\n").arg(faceSubsetIndices.size()));
+
+	// vertices, with the global scale from usd to be in meter
+	const auto globalScale = mesh.metersPerUnit;
+	{
+		const auto *src = points.cdata();
+		geo.vtx.resize(points.size());
+		auto *dst = geo.vtx.data();
+		for (size_t i = 0; i < points.size(); ++i)
+			dst[i] = hg::Vec3(src[i][0] * globalScale, src[i][1] * globalScale, src[i][2] * globalScale);
+	}
+
+	// joint influences, per vertex as the points
+	if (mesh.skin.size() == points.size()) {
+		geo.skin = mesh.skin;
+		geo.bind_pose = mesh.bindPose;
+	}
+
+	const auto *counts = faceVertexCounts.cdata();
+	const auto *indices = faceVertexIndices.cdata();
+
+	// offset of each face in the face-varying arrays
+	std::vector<size_t> face_offsets(faceVertexCounts.size());
+	size_t face_offset = 0;
+	for (size_t fid = 0; fid < faceVertexCounts.size(); ++fid) {
+		face_offsets[fid] = face_offset;
+		face_offset += counts[fid];
+	}
+
+	// faces to export, in mesh order. A subset only selects its faces, each face at most once. Holes are not exported.
+	std::vector<uint8_t> selected(faceVertexCounts.size(), mesh.isSubset ? 0 : 1);
+	if (mesh.isSubset)
+		for (const auto &fid : faceSubsetIndices)
+			if (fid >= 0 && size_t(fid) < selected.size())
+				selected[fid] = 1;
+	for (const auto &fid : mesh.holeIndices)
+		if (fid >= 0 && size_t(fid) < selected.size())
+			selected[fid] = 0;
+
+	std::vector<uint32_t> faces;
+	faces.reserve(mesh.isSubset ? faceSubsetIndices.size() : selected.size());
+	for (size_t fid = 0; fid < selected.size(); ++fid)
+		if (selected[fid] && counts[fid] >= 3)
+			faces.push_back(uint32_t(fid));
+
+	// source face-varying index and face of each polygon-vertex. Faces are split into triangles so that the geometry is ready to load and
+	// faces of any size are supported, winding is reversed.
+	std::vector<uint32_t> corner_fv, corner_face;
+	{
+		size_t triangle_count = 0;
+		for (const auto &fid : faces)
+			triangle_count += counts[fid] - 2;
+		corner_fv.reserve(triangle_count * 3);
+		corner_face.reserve(triangle_count * 3);
+
+		TraceScope trace_scope("Triangulate", mesh.path);
+
+		PolygonTriangulator triangulator;
+		std::vector<hg::Vec3> face_points;
+		std::vector<uint32_t> face_triangles;
+
+		for (const auto &fid : faces) {
+			const int f_count = counts[fid];
+			const size_t f_last = face_offsets[fid] + f_count - 1;
+
+			face_points.resize(f_count);
+			for (int f = 0; f < f_count; ++f) {
+				const auto v = indices[f_last - f];
+				face_points[f] = v >= 0 && size_t(v) < geo.vtx.size() ? geo.vtx[v] : hg::Vec3(0.f, 0.f, 0.f);
+			}
+
+			face_triangles.clear();
+			triangulator.Triangulate(face_points, face_triangles);
+
+			for (const auto f : face_triangles) {
+				corner_fv.push_back(uint32_t(f_last - f));
+				corner_face.push_back(fid);
+			}
+		}
+	}
+
+	const size_t corner_count = corner_fv.size();
+	geo.pol.assign(corner_count / 3, hg::Geometry::Polygon{3, 0});
+
+	// indices
+	geo.binding.resize(corner_count);
+	for (size_t c = 0; c < corner_count; ++c)
+		geo.binding[c] = uint32_t(indices[corner_fv[c]]);
+
+	const auto point_count = points.size(), face_count = faceVertexCounts.size(), fv_count = faceVertexIndices.size();
+
+	// normal x,y,z
+	if (normals.size()) {
+		const auto mapping = GetPrimvarMapping(mesh.normalsInterpolation, normals.size(), point_count, face_count, fv_count);
+		if (mapping != PrimvarMapping::Invalid) {
+			geo.normal.resize(corner_count);
+			ExpandPrimvar(normals.cdata(), mapping, corner_fv.data(), geo.binding.data(), corner_face.data(), geo.normal.data(), corner_count,
+				[](const pxr::GfVec3f &n) { return hg::Vec3(n[0], n[1], n[2]); });
+		} else
+			hg::error(hg::format("Unexpected normal count %1 on '%2'").arg(normals.size()).arg(mesh.path.GetString()));
+	}
+
+	// u, v
+	for (size_t i = 0; i < uvs.size(); ++i) {
+		const auto mapping = GetPrimvarMapping(mesh.uvsInterpolation[i], uvs[i].size(), point_count, face_count, fv_count);
+		if (mapping != PrimvarMapping::Invalid) {
+			geo.uv[i].resize(corner_count);
+			ExpandPrimvar(uvs[i].cdata(), mapping, corner_fv.data(), geo.binding.data(), corner_face.data(), geo.uv[i].data(), corner_count,
+				[](const pxr::GfVec2f &uv) { return hg::Vec2(uv[0], 1.f - uv[1]); });
+		} else
+			hg::error(hg::format("Unexpected uv count %1 on '%2'").arg(uvs[i].size()).arg(mesh.path.GetString()));
+	}
+}
+
+// Incremental import: the manifest written next to the scene records a fingerprint of every layer used by the stage and, for each
+// exported prim, geometry and material, the layers holding an opinion on its prims. A geometry is only converted again when one of these
+// layers changed, an unchanged material is rebuilt from the manifest without evaluating its shader network or hashing its textures and the
+// scene of the previous run is patched, only the nodes of the changed prims are exported again. A run with other options than the previous
+// one replaces all of its outputs.
+struct IncrementalImport {
+	bool enabled{false};
+	std::string manifest_path;
+	std::string salt; // options of this run
+	json previous; // manifest of the previous run
+	json layers = json::object(), prims = json::object(), geometries = json::object(), materials = json::object(); // manifest of this run
+	std::set<std::string> changed_layers;
+	bool options_changed{false};
+	const hg::Scene *scene{nullptr}; // scene whose exported prims are recorded
+
+	bool HasChanges() const { return previous.is_null() || options_changed || !changed_layers.empty(); }
+};
+
+static IncrementalImport incremental;
+
+// Fingerprint the layers used by the stage not fingerprinted yet. The content of a layer is only hashed again when its modification time
+// changed.
+static void FingerprintLayers(const pxr::UsdStage &stage) {
+	const json no_layers = json::object();
+	const auto &previous_layers = incremental.previous.is_object() ? incremental.previous.value("layers", no_layers) : no_layers;
+
+	for (const auto &layer : stage.GetUsedLayers()) {
+		const auto identifier = layer->GetIdentifier();
+		if (incremental.layers.contains(identifier))
+			continue;
+
+		const auto real_path = layer->GetRealPath();
+
+		int64_t mtime = 0;
+		std::string sha1;
+
+		std::error_code ec;
+		if (!real_path.empty() && !layer->IsDirty()) {
+			const auto time = std::filesystem::last_write_time(real_path, ec);
+			if (!ec)
+				mtime = int64_t(time.time_since_epoch().count());
+		}
+
+		const auto i = previous_layers.find(identifier);
+		if (mtime && i != previous_layers.end() && i->value("mtime", int64_t(0)) == mtime) {
+			sha1 = i->value("sha1", std::string());
+		} else if (mtime) {
+			if (const auto asset = pxr::ArGetResolver().OpenAsset(pxr::ArResolvedPath(real_path)))
+				sha1 = ComputeAssetSHA1(*asset);
+		} else {
+			std::string content; // anonymous or modified in memory
+			layer->ExportToString(&content);
+			sha1 = hg::ComputeSHA1String(content.data(), content.size());
+		}
+
+		if (i == previous_layers.end() || i->value("sha1", std::string()) != sha1 || sha1.empty())
+			incremental.changed_layers.insert(identifier);
+
+		incremental.layers[identifier] = {{"mtime", mtime}, {"sha1", sha1}};
+	}
+}
+
+// Options and stage metrics the outputs depend on, the geometries and materials also record the options they were converted with.
+static std::string GetSceneManifestSalt(const pxr::UsdStageRefPtr &stage, const Config &config) {
+	std::string salt = "scn-1 prj=" + config.prj_path + " prefix=" + config.prefix + " shader=" + config.shader;
+	salt += " scale=" + std::to_string(config.geometry_scale) + " fps=" + std::to_string(config.frame_per_second);
+	salt += std::string(config.import_animation ? " animation" : "") + (config.anim_to_file ? " anim-to-file" : "") + " anim-tolerance=" +
+			std::to_string(config.anim_tolerance);
+	salt += config.scene_format == SceneFormat::Binary ? " binary" : " json";
+	salt += std::string(config.recalculate_normal ? " recalculate-normal" : "") + (config.recalculate_tangent ? " recalculate-tangent" : "") +
+			(config.optimize_mesh ? " optimize-mesh" : "") + (config.quantize_geometry ? " quantize" : "") +
+			(config.detect_geometry_instances ? " instances" : "") + (config.instancer_arrays ? " instancer-arrays" : "") +
+			(config.scene_bvh ? " bvh" : "");
+	salt += " lod=" + std::to_string(config.lod_count) + "-" + std::to_string(config.lod_ratio);
+	for (const auto &path : config.include_paths)
+		salt += " include=" + path.GetString();
+	for (const auto &path : config.exclude_paths)
+		salt += " exclude=" + path.GetString();
+	salt += " up=" + pxr::UsdGeomGetStageUpAxis(stage).GetString() + " mpu=" + std::to_string(pxr::UsdGeomGetStageMetersPerUnit(stage));
+	return salt;
+}
+
+static void LoadIncrementalManifest(const pxr::UsdStageRefPtr &stage, const std::string &manifest_path, const Config &config) {
+	incremental.enabled = true;
+	incremental.manifest_path = manifest_path;
+	incremental.salt = GetSceneManifestSalt(stage, config);
+
+	std::ifstream file(manifest_path);
+	if (file) {
+		incremental.previous = json::parse(file, nullptr, false);
+		if (!incremental.previous.is_object() || incremental.previous.value("version", 0) != 1) {
+			hg::warn(hg::format("Ignoring invalid import manifest '%1'").arg(manifest_path));
+			incremental.previous = nullptr;
+		}
+	}
+
+	if (incremental.previous.is_object() && incremental.previous.value("salt", std::string()) != incremental.salt) {
+		hg::log("Incremental import: options changed since the previous import, all outputs are replaced");
+		incremental.options_changed = true;
+	}
+
+	FingerprintLayers(*stage);
+	hg::log(hg::format("Incremental import: %1 layer(s) changed out of %2").arg(incremental.changed_layers.size()).arg(incremental.layers.size()));
+}
+
+// scene_path is the scene saved by this run, patchable is cleared when the next run can not patch it.
+static void SaveIncrementalManifest(const std::string &scene_path, bool patchable) {
+	const json manifest = {{"version", 1}, {"salt", incremental.salt}, {"scene", scene_path}, {"patchable", patchable}, {"layers", incremental.layers},
+		{"prims", incremental.prims}, {"geometries", incremental.geometries}, {"materials", incremental.materials}};
+	output_writer.Write(incremental.manifest_path, manifest.dump(1, '\t'));
+}
+
+static void AddContributingLayers(const pxr::UsdPrim &prim, std::set<std::string> &layers) {
+	for (auto o : prim.GetPrimIndex().GetNodeRange())
+		for (const auto &layer : o.GetLayerStack()->GetLayers())
+			if (layer->HasSpec(o.GetPath()))
+				layers.insert(layer->GetIdentifier());
+}
+
+// Identifiers of the layers holding an opinion on a prim, for a subset this includes the opinions on its mesh.
+static std::vector<std::string> GetContributingLayers(const pxr::UsdPrim &p) {
+	std::set<std::string> layers;
+	for (auto prim = p; prim; prim = prim.GetTypeName() == "GeomSubset" ? prim.GetParent() : pxr::UsdPrim())
+		AddContributingLayers(prim, layers);
+	return {layers.begin(), layers.end()};
+}
+
+// Identifiers of the layers holding an opinion on a material or the prims below it, which hold its shader network.
+static std::vector<std::string> GetMaterialContributingLayers(const pxr::UsdShadeMaterial &material) {
+	std::set<std::string> layers;
+	for (const auto &prim : pxr::UsdPrimRange(material.GetPrim()))
+		AddContributingLayers(prim, layers);
+	return {layers.begin(), layers.end()};
+}
+
+// Check that none of the layers of a manifest entry changed.
+static bool AreLayersUnchanged(const json &layers) {
+	for (const auto &layer : layers)
+		if (incremental.changed_layers.count(layer.get<std::string>()))
+			return false;
+	return true;
+}
+
+// Check a geometry against the previous run manifest and record it in the manifest of this run.
+static bool UpdateGeometryManifest(const pxr::UsdPrim &p, const std::set<pxr::TfToken> &uvMapVarname, const std::string &salt) {
+	const auto key = p.GetPath().GetString();
+
+	std::vector<std::string> uv_names;
+	for (const auto &uv : uvMapVarname)
+		uv_names.push_back(uv.GetString());
+
+	const json entry = {{"layers", GetContributingLayers(p)}, {"uv", uv_names}, {"salt", salt}};
+	incremental.geometries[key] = entry;
+
+	if (!incremental.previous.is_object() || !incremental.previous.contains("geometries"))
+		return false;
+
+	const auto &previous_geometries = incremental.previous["geometries"];
+	const auto i = previous_geometries.find(key);
+	if (i == previous_geometries.end() || *i != entry)
+		return false;
+	return AreLayersUnchanged(entry["layers"]);
+}
+
+// Policy of an output derived from the whole stage, in incremental mode a stale output is replaced even if the policy is to skip it.
+static ImportPolicy GetIncrementalPolicy(ImportPolicy policy, bool up_to_date) {
+	if (incremental.enabled && !up_to_date && policy == ImportPolicy::SkipExisting)
+		return ImportPolicy::Overwrite;
+	return policy;
+}
+
+// Materials converted during this import, keyed by bound material path and double-sided flag. Meshes sharing a material reuse the
+// converted material instead of evaluating the shader network again.
+struct ConvertedMaterial {
+	hg::Material mat;
+	std::string name;
+	std::set<pxr::TfToken> uvMapVarname;
+};
+
+std::map<std::pair<std::string, bool>, ConvertedMaterial> converted_materials;
+
+// Identify the importer version and the options a converted material depends on.
+static std::string GetMaterialManifestSalt(const Config &config) { return "mat-1 shader=" + config.shader + " prefix=" + config.prefix; }
+
+static std::string GetMaterialManifestKey(const pxr::UsdShadeMaterial &material, bool double_sided) {
+	return material.GetPath().GetString() + (double_sided ? " double-sided" : "");
+}
+
+// Record a converted material in the manifest of this run, with the textures it references. A texture is identified by the stamp of its
+// file so that a changed picture is imported again.
+static void UpdateMaterialManifest(const pxr::UsdShadeMaterial &material, const pxr::UsdShadeShader &shader, bool double_sided,
+	const ConvertedMaterial &entry, const Config &config, const hg::PipelineResources &resources) {
+	json values = json::object();
+	for (const auto &[name, value] : entry.mat.values)
+		values[name] = {{"type", int(value.type)}, {"value", value.value}};
+
+	json textures = json::object();
+	for (const auto &[name, texture] : entry.mat.textures)
+		textures[name] = {{"texture", resources.textures.GetName(texture.texture)}, {"channel", texture.channel}};
+
+	json assets = json::array();
+	for (const auto &assetPath : GetShaderTextureAssets(shader)) {
+		const auto texture = picture_asset_path_to_tex_ref.Find(assetPath.GetAssetPath());
+		if (!texture || *texture == hg::InvalidTextureRef)
+			return; // not imported, the material is converted again by the next run
+
+		assets.push_back({{"asset", assetPath.GetAssetPath()}, {"resolved", assetPath.GetResolvedPath()},
+			{"stamp", GetAssetStampKey(assetPath.GetResolvedPath())}, {"texture", resources.textures.GetName(*texture)}});
+	}
+
+	std::vector<std::string> uv_names;
+	for (const auto &uv : entry.uvMapVarname)
+		uv_names.push_back(uv.GetString());
+
+	incremental.materials[GetMaterialManifestKey(material, double_sided)] = {{"layers", GetMaterialContributingLayers(material)},
+		{"salt", GetMaterialManifestSalt(config)}, {"name", entry.name}, {"uv", uv_names}, {"program", resources.programs.GetName(entry.mat.program)},
+		{"alpha_blend", hg::GetMaterialBlendMode(entry.mat) == hg::BM_Alpha}, {"values", values}, {"textures", textures}, {"assets", assets}};
+}
+
+// Rebuild a material converted by the previous run if none of its layers and textures changed since. Its textures were written by the
+// previous run, they are not hashed nor written again.
+static bool FindManifestMaterial(const pxr::UsdShadeMaterial &material, bool double_sided, const Config &config, hg::PipelineResources &resources,
+	ConvertedMaterial &converted) {
+	if (!material || !incremental.previous.is_object() || !incremental.previous.contains("materials"))
+		return false;
+
+	const auto key = GetMaterialManifestKey(material, double_sided);
+	const auto &previous_materials = incremental.previous["materials"];
+	const auto i = previous_materials.find(key);
+	if (i == previous_materials.end() || i->value("salt", std::string()) != GetMaterialManifestSalt(config))
+		return false;
+
+	const auto &entry = *i;
+	if (!entry.contains("layers") || entry["layers"] != json(GetMaterialContributingLayers(material)) || !AreLayersUnchanged(entry["layers"]))
+		return false;
+
+	for (const auto &asset : entry.value("assets", json::array())) {
+		const auto stamp = asset.value("stamp", std::string());
+		if (stamp.empty() || stamp != GetAssetStampKey(asset.value("resolved", std::string())) ||
+			!hg::Exists((config.prj_path + "/" + asset.value("texture", std::string())).c_str()))
+			return false;
+	}
+
+	auto &mat = converted.mat;
+	mat.program = resources.programs.Add(entry.value("program", std::string()).c_str(), {});
+	for (const auto &[name, value] : entry.value("values", json::object()).items())
+		mat.values[name] = {bgfx::UniformType::Enum(value.value("type", 0)), value.value("value", std::vector<float>())};
+	for (const auto &[name, texture] : entry.value("textures", json::object()).items())
+		mat.textures[name] = {resources.textures.Add(texture.value("texture", std::string()).c_str(), {BGFX_SAMPLER_NONE, BGFX_INVALID_HANDLE}),
+			texture.value("channel", uint8_t(0))};
+
+	if (entry.value("alpha_blend", false))
+		SetMaterialBlendMode(mat, hg::BM_Alpha);
+	if (double_sided)
+		SetMaterialFaceCulling(mat, hg::FC_Disabled);
+
+	converted.name = entry.value("name", std::string());
+	for (const auto &uv : entry.value("uv", std::vector<std::string>()))
+		converted.uvMapVarname.insert(pxr::TfToken(uv));
+
+	// the textures of the material are not imported again by the materials sharing them
+	for (const auto &asset : entry.value("assets", json::array())) {
+		const auto texRef = resources.textures.Add(asset.value("texture", std::string()).c_str(), {BGFX_SAMPLER_NONE, BGFX_INVALID_HANDLE});
+		picture_asset_path_to_tex_ref.Insert(asset.value("asset", std::string()), texRef);
+	}
+
+	incremental.materials[key] = entry;
+	hg::debug(hg::format("Material '%1' is unchanged, reused from the previous import").arg(material.GetPath().GetString()));
+	return true;
+}
+
+// Surface shader of a material.
+static pxr::UsdShadeShader GetMaterialSurfaceShader(const pxr::UsdShadeMaterial &shadeMaterial) {
+	pxr::UsdShadeShader shader = shadeMaterial.ComputeSurfaceSource();
+
+	// if there is no shader with defaut render context, find the ONE
+	if (!shader) {
+		// find the output surface with the UsdPreviewSurface (we handle this one for now)
+		auto outputs = shadeMaterial.GetSurfaceOutputs();
+		for (const auto &output : outputs) {
+			if (output.HasConnectedSource()) {
+				// get the source connected to the output
+				auto sourceOutput = output.GetConnectedSources()[0].source;
+				auto sourceShaderName = sourceOutput.GetPrim().GetName().GetString();
+				if (sourceShaderName == "UsdPreviewSurface")
+					shader = pxr::UsdShadeShader(sourceOutput.GetPrim());
+			}
+		}
+	}
+	return shader;
+}
+
+static hg::Object GetObjectWithMaterial(const pxr::UsdPrim &p, std::set<pxr::TfToken> &uvMapVarname, hg::Scene &scene,
+	const Config &config, hg::PipelineResources &resources, bool skinned = false) {
+
+	pxr::UsdGeomMesh geoUSD(p);
+
+	std::string path = p.GetPath().GetString();
+	auto object = scene.CreateObject();
+
+	// the material of a skinned object is a copy of the converted one with skinning enabled
+	const auto set_material = [&](hg::Material mat, const std::string &name) {
+		if (skinned)
+			mat.flags |= hg::MF_EnableSkinning;
+		object.SetMaterial(0, std::move(mat));
+		object.SetMaterialName(0, name);
+	};
+
+	// Add material to the primitive.
+	// MATERIALS:
+	// Assign one material per primitive.
+	bool foundMat = false;
+	pxr::UsdShadeMaterialBindingAPI materialBinding(p);
+	auto binding = materialBinding.GetDirectBinding();
+
+	// check double side
+	bool isDoubleSided = false;
+	geoUSD.GetDoubleSidedAttr().Get(&isDoubleSided);
+	// if it's a geo subset check the parent 
+	if (p.GetTypeName() == "GeomSubset")
+		pxr::UsdGeomMesh(p.GetParent()).GetDoubleSidedAttr().Get(&isDoubleSided);
+
+	const auto converted_key = std::make_pair(binding.GetMaterialPath().GetString(), isDoubleSided);
+	auto converted = converted_materials.find(converted_key);
+
+	ConvertedMaterial unchanged;
+	if (converted != std::end(converted_materials)) {
+		foundMat = true;
+
+		uvMapVarname.insert(std::begin(converted->second.uvMapVarname), std::end(converted->second.uvMapVarname));
+		set_material(converted->second.mat, converted->second.name);
+	} else if (incremental.enabled && FindManifestMaterial(binding.GetMaterial(), isDoubleSided, config, resources, unchanged)) {
+		foundMat = true;
+
+		const auto &entry = converted_materials[converted_key] = std::move(unchanged);
+		uvMapVarname.insert(std::begin(entry.uvMapVarname), std::end(entry.uvMapVarname));
+		set_material(entry.mat, entry.name);
+	} else if (pxr::UsdShadeMaterial shadeMaterial = binding.GetMaterial()) {
+		if (pxr::UsdShadeShader shader = GetMaterialSurfaceShader(shadeMaterial)) {
+			foundMat = true;
+
+			// get the material
+			ConvertedMaterial &entry = converted_materials[converted_key];
+			entry.mat = ExportMaterial(shader, entry.uvMapVarname, *p.GetStage(), config, resources);
+			entry.name = shader.GetPath().GetString();
+
+			if (isDoubleSided)
+				SetMaterialFaceCulling(entry.mat, hg::FC_Disabled);
+
+			uvMapVarname.insert(std::begin(entry.uvMapVarname), std::end(entry.uvMapVarname));
+			set_material(entry.mat, entry.name);
+
+			if (incremental.enabled)
+				UpdateMaterialManifest(shadeMaterial, shader, isDoubleSided, entry, config, resources);
+		}else
+			hg::error("!Unexpected shader from UsdShadeShader()");
+	}
+	
+	// If the material is not found, create a dummy material to make the object visible in the engine.
+	if(!foundMat) {
+		hg::debug(hg::format("	- Has no material, set a dummy one"));
+
+		hg::Material mat;
+		std::string shader;
+
+		shader = "core/shader/pbr.hps";
+
+		if (!config.shader.empty())
+			shader = config.shader; // Use the overridden shader if it is provided in the configuration.
+
+		hg::debug(hg::format("	- Using pipeline shader '%1'").arg(shader));
+		mat.program = resources.programs.Add(shader.c_str(), {});
+
+		// check in case there is special primvars
+		hg::Vec4 diffuse = {0.5f, 0.5f, 0.5f, 1.f};
+		if (auto diffuseAttr = p.GetAttribute(pxr::TfToken("primvars:displayColor"))) {
+			//auto y = diffuseAttr.GetTypeName().GetCPPTypeName();
+			pxr::VtArray<pxr::GfVec3f> diffuseUSD;
+			diffuseAttr.Get(&diffuseUSD);
+			if (diffuseUSD.size() > 1) {
+				diffuse.x = diffuseUSD[0].data()[0];
+				diffuse.y = diffuseUSD[0].data()[1];
+				diffuse.z = diffuseUSD[0].data()[2];
+			}
+		}
+
+		mat.values["uBaseOpacityColor"] = {bgfx::UniformType::Vec4, {diffuse.x, diffuse.y, diffuse.z, diffuse.w}};
+		mat.values["uOcclusionRoughnessMetalnessColor"] = {bgfx::UniformType::Vec4, {1.f, 1.f, 0.f, -1.f}};
+		mat.values["uSelfColor"] = {bgfx::UniformType::Vec4, {0.f, 0.f, 0.f, -1.f}};
+
+		set_material(std::move(mat), "dummy_mat");
+	}
+
+	return object;
+}
+// Object exported for a prim, offset places the geometry when it is shared with a mesh differing by a rigid transform.
+struct ExportedObject {
+	hg::Object object;
+	hg::Mat4 offset{hg::Mat4::Identity};
+	const struct GeometryBounds *bounds{nullptr}; // with -scene-bvh
+};
+
+// Identity of the geometry of a prim: the layer stack and path of the last node of its prim index. Layer stacks are interned to an index,
+// paths already are.
+struct PrimIdentity {
+	uint32_t layer_stack{0};
+	pxr::SdfPath path;
+
+	bool operator==(const PrimIdentity &o) const { return layer_stack == o.layer_stack && path == o.path; }
+};
+
+struct PrimIdentityHash {
+	size_t operator()(const PrimIdentity &id) const { return id.path.GetHash() ^ (size_t(id.layer_stack) * 0xff51afd7ed558ccdull); }
+};
+
+// Layer stacks are told apart by their identifier as printed, the same identity as the string keys used before. Layer stack objects are
+// recreated when the payloads are reloaded, the printed identifier is only computed for the layer stacks not seen yet.
+struct InternedLayerStack {
+	pxr::PcpLayerStackPtr layer_stack; // expires with the layer stack, its address may then be reused
+	uint32_t index{0};
+};
+
+FlatMap<const pxr::PcpLayerStack *, InternedLayerStack> layer_stack_by_address;
+FlatMap<std::string, uint32_t> layer_stack_by_identifier;
+
+static uint32_t InternLayerStack(const pxr::PcpLayerStackRefPtr &layer_stack) {
+	const auto address = get_pointer(layer_stack);
+	if (const auto interned = layer_stack_by_address.Find(address); interned && interned->layer_stack)
+		return interned->index;
+
+	const auto index = *layer_stack_by_identifier.Insert(pxr::TfStringify(layer_stack), uint32_t(layer_stack_by_identifier.size())).first;
+	layer_stack_by_address.Set(address, {layer_stack, index});
+	return index;
+}
+
+static PrimIdentity GetPrimIdentity(const pxr::UsdPrim &p) {
+	pxr::PcpNodeRef last;
+	for (auto o : p.GetPrimIndex().GetNodeRange())
+		last = o;
+	return {InternLayerStack(last.GetLayerStack()), last.GetPath()};
+}
+
+SharedMap<PrimIdentity, ExportedObject, PrimIdentityHash> primToObject;
+SharedMap<std::string, std::string> protoToInstance;
+
+// Bounds of a geometry in its own space, set by the geometry workers and read once they are done.
+struct GeometryBounds {
+	hg::MinMax minmax;
+	bool valid{false};
+};
+
+static std::deque<GeometryBounds> geometry_bounds; // elements are not moved as the traversal adds to it
+
+// Bounds of the points of a mesh, the authored extent if any. A subset is bounded by the points of its mesh.
+static void ComputeGeometryBounds(const pxr::VtArray<pxr::GfVec3f> &extent, const pxr::VtArray<pxr::GfVec3f> &points, float meters_per_unit, GeometryBounds &bounds) {
+	const auto to_vec3 = [meters_per_unit](const pxr::GfVec3f &v) { return hg::Vec3(v[0], v[1], v[2]) * meters_per_unit; };
+
+	if (extent.size() == 2) {
+		bounds = {{to_vec3(extent.cdata()[0]), to_vec3(extent.cdata()[1])}, true};
+		return;
+	}
+	if (points.empty())
+		return;
+
+	const auto *src = points.cdata();
+	hg::Vec3 mn = to_vec3(src[0]), mx = mn;
+	for (size_t i = 1; i < points.size(); ++i) {
+		const auto v = to_vec3(src[i]);
+		mn = hg::Min(mn, v);
+		mx = hg::Max(mx, v);
+	}
+	bounds = {{mn, mx}, true};
+}
+
+// Bounds of a geometry that is not converted, read without the rest of the mesh.
+static void ReadGeometryBounds(const pxr::UsdPrim &p, GeometryBounds &bounds) {
+	const pxr::UsdGeomMesh mesh(p.GetTypeName() == "GeomSubset" ? p.GetParent() : p);
+
+	pxr::VtArray<pxr::GfVec3f> extent, points;
+	if (!mesh.GetExtentAttr().Get(&extent) || extent.size() != 2)
+		mesh.GetPointsAttr().Get(&points);
+	ComputeGeometryBounds(extent, points, float(pxr::UsdGeomGetStageMetersPerUnit(p.GetStage())), bounds);
+}
+
+// Geometry conversion queued by the scene traversal, everything in it is independent from the scene and resources.
+struct GeometryJob {
+	pxr::UsdPrim prim; // Mesh or GeomSubset
+	std::set<pxr::TfToken> uvMapVarname;
+	std::optional<MeshSource> mesh; // already read by the traversal when detecting geometry instances
+	std::shared_ptr<const SkinBinding> skin; // null if the mesh is not skinned
+	std::string path; // output path of the geometry
+	bool save{false};
+	GeometryBounds *bounds{nullptr}; // set from the mesh if not null
+};
+
+static WorkerPool geometry_pool;
+
+// Hash of everything a geometry conversion reads, used as the key of the geometry in the content cache.
+static std::string ComputeMeshSourceSHA1(const MeshSource &mesh, const std::string &salt) {
+	std::string digests = salt;
+	const auto add = [&digests](const void *data, size_t size) { digests += hg::ComputeSHA1String(reinterpret_cast<const char *>(data), size); };
+
+	add(mesh.points.cdata(), mesh.points.size() * sizeof(pxr::GfVec3f));
+	add(mesh.normals.cdata(), mesh.normals.size() * sizeof(pxr::GfVec3f));
+	add(mesh.faceVertexCounts.cdata(), mesh.faceVertexCounts.size() * sizeof(int));
+	add(mesh.faceVertexIndices.cdata(), mesh.faceVertexIndices.size() * sizeof(int));
+	add(mesh.faceSubsetIndices.cdata(), mesh.faceSubsetIndices.size() * sizeof(int));
+	add(mesh.holeIndices.cdata(), mesh.holeIndices.size() * sizeof(int));
+	for (const auto &uv : mesh.uvs)
+		add(uv.cdata(), uv.size() * sizeof(pxr::GfVec2f));
+	add(mesh.skin.data(), mesh.skin.size() * sizeof(hg::Geometry::Skin));
+	add(mesh.bindPose.data(), mesh.bindPose.size() * sizeof(hg::Mat4));
+
+	digests += mesh.normalsInterpolation.GetString();
+	for (const auto &interpolation : mesh.uvsInterpolation)
+		digests += " " + interpolation.GetString();
+	digests += mesh.isSubset ? " subset " : " mesh ";
+	digests += std::to_string(mesh.metersPerUnit);
+
+	return hg::ComputeSHA1String(digests.data(), digests.size());
+}
+
+// Frame of a mesh following its points when the mesh is moved or rotated: the origin is the centroid of the points, the axes point toward
+// the first points far enough from the centroid and from the first axis. Points are matched by index, so are the axes of two meshes only
+// differing by a rigid transform.
+struct RigidFrame {
+	double origin[3]{};
+	double axes[3][3]{}; // rows, from mesh to frame space
+};
+
+static bool ComputeRigidFrame(const pxr::VtArray<pxr::GfVec3f> &points, RigidFrame &frame, double &radius) {
+	const size_t count = points.size();
+	if (!count)
+		return false;
+
+	const auto *src = points.cdata();
+
+	double *o = frame.origin;
+	for (size_t i = 0; i < count; ++i)
+		for (int k = 0; k < 3; ++k)
+			o[k] += src[i][k];
+	for (int k = 0; k < 3; ++k)
+		o[k] /= double(count);
+
+	const auto dot = [](const double *a, const double *b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; };
+	const auto offset = [&](size_t i, double *d) {
+		for (int k = 0; k < 3; ++k)
+			d[k] = src[i][k] - o[k];
+	};
+
+	double d[3], radius2 = 0.;
+	for (size_t i = 0; i < count; ++i) {
+		offset(i, d);
+		radius2 = std::max(radius2, dot(d, d));
+	}
+	if (radius2 <= 0.)
+		return false;
+	radius = std::sqrt(radius2);
+
+	double *e0 = frame.axes[0], *e1 = frame.axes[1], *e2 = frame.axes[2];
+
+	size_t i = 0;
+	for (; i < count; ++i) {
+		offset(i, e0);
+		if (dot(e0, e0) > radius2 * 0.25)
+			break;
+	}
+	const double l0 = std::sqrt(dot(e0, e0));
+	for (int k = 0; k < 3; ++k)
+		e0[k] /= l0;
+
+	for (i = 0; i < count; ++i) {
+		offset(i, e1);
+		const double along = dot(e1, e0);
+		for (int k = 0; k < 3; ++k)
+			e1[k] -= along * e0[k];
+		if (dot(e1, e1) > radius2 * 0.0625)
+			break;
+	}
+	if (i == count)
+		return false; // points on a line, any rotation around it matches
+
+	const double l1 = std::sqrt(dot(e1, e1));
+	for (int k = 0; k < 3; ++k)
+		e1[k] /= l1;
+
+	e2[0] = e0[1] * e1[2] - e0[2] * e1[1];
+	e2[1] = e0[2] * e1[0] - e0[0] * e1[2];
+	e2[2] = e0[0] * e1[1] - e0[1] * e1[0];
+	return true;
+}
+
+// Fast non cryptographic hash, geometry instances are detected on the scene traversal.
+static uint64_t HashBytes(const void *data, size_t size, uint64_t h) {
+	const auto *p = static_cast<const uint8_t *>(data);
+	const auto mix = [&h](uint64_t v) {
+		v *= 0xbf58476d1ce4e5b9ull;
+		v ^= v >> 31;
+		h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 29;
+	};
+
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		mix(v);
+	}
+	uint64_t tail = size;
+	for (size_t i = 0; i < size; ++i)
+		tail = (tail << 8) | p[i];
+	mix(tail);
+	return h;
+}
+
+// Content of a mesh compared by -detect-geometry-instances once its key matches. For a rigid match, the points and normals are in the rigid
+// frame of the mesh.
+struct GeometryInstanceSource {
+	hg::ModelRef model;
+	std::string path; // of the prim the geometry was converted from
+	RigidFrame frame;
+	double radius{0.}, magnitude{0.}; // largest distance from the frame origin and largest coordinate of the points, in mesh space
+	std::vector<pxr::GfVec3f> points, normals;
+	const GeometryBounds *bounds{nullptr};
+};
+
+// Geometries saved with -detect-geometry-instances by content key, only accessed by the scene traversal. The key only holds what a rigid
+// transform keeps exactly, the candidates of a key are told apart by their points.
+std::map<std::string, std::vector<GeometryInstanceSource>> geometry_instances;
+
+static void ToRigidFrame(const pxr::VtArray<pxr::GfVec3f> &vectors, const double *origin, const double (*axes)[3], std::vector<pxr::GfVec3f> &out) {
+	out.resize(vectors.size());
+	const auto *src = vectors.cdata();
+	for (size_t i = 0; i < vectors.size(); ++i) {
+		const double d[3] = {src[i][0] - origin[0], src[i][1] - origin[1], src[i][2] - origin[2]};
+		for (int k = 0; k < 3; ++k)
+			out[i][k] = float(axes[k][0] * d[0] + axes[k][1] * d[1] + axes[k][2] * d[2]);
+	}
+}
+
+// Key of the content of a mesh: counts, topology, subset indices, converted uvs and, without rigid set, its points and normals. With rigid set,
+// the points and normals are left to IsSameGeometryInstance in the rigid frame of the mesh, a moved copy carries rounding errors that no hash
+// of its coordinates would absorb. rigid is cleared if the mesh has no such frame.
+static std::string ComputeGeometryInstanceKey(const MeshSource &mesh, bool &rigid, GeometryInstanceSource &instance) {
+	TraceScope trace_scope("ComputeGeometryInstanceKey", mesh.path);
+
+	rigid = rigid && ComputeRigidFrame(mesh.points, instance.frame, instance.radius);
+
+	uint64_t h = 0x243f6a8885a308d3ull;
+	if (rigid) {
+		const double zero[3] = {0., 0., 0.};
+		ToRigidFrame(mesh.points, instance.frame.origin, instance.frame.axes, instance.points);
+		ToRigidFrame(mesh.normals, zero, instance.frame.axes, instance.normals);
+		for (const auto &point : mesh.points)
+			for (int k = 0; k < 3; ++k)
+				instance.magnitude = std::max(instance.magnitude, double(std::abs(point[k])));
+	} else {
+		instance.points.assign(mesh.points.begin(), mesh.points.end());
+		instance.normals.assign(mesh.normals.begin(), mesh.normals.end());
+		h = HashBytes(mesh.points.cdata(), mesh.points.size() * sizeof(pxr::GfVec3f), h);
+		h = HashBytes(mesh.normals.cdata(), mesh.normals.size() * sizeof(pxr::GfVec3f), h);
+	}
+
+	h = HashBytes(mesh.faceVertexCounts.cdata(), mesh.faceVertexCounts.size() * sizeof(int), h);
+	h = HashBytes(mesh.faceVertexIndices.cdata(), mesh.faceVertexIndices.size() * sizeof(int), h);
+	h = HashBytes(mesh.faceSubsetIndices.cdata(), mesh.faceSubsetIndices.size() * sizeof(int), h);
+	h = HashBytes(mesh.holeIndices.cdata(), mesh.holeIndices.size() * sizeof(int), h);
+	for (const auto &uv : mesh.uvs)
+		h = HashBytes(uv.cdata(), uv.size() * sizeof(pxr::GfVec2f), h);
+
+	std::string key = rigid ? "rigid" : "exact";
+	key += mesh.isSubset ? " subset " : " mesh ";
+	key += mesh.normalsInterpolation.GetString();
+	for (const auto &interpolation : mesh.uvsInterpolation)
+		key += " " + interpolation.GetString();
+
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(h));
+	return key + " " + std::to_string(mesh.points.size()) + " " + std::to_string(mesh.normals.size()) + " " +
+		   std::to_string(mesh.faceVertexIndices.size()) + " " + std::to_string(mesh.metersPerUnit) + " " + hash;
+}
+
+// Compare the points and normals of two meshes with the same key. In the rigid frame, points match within a tolerance covering the float
+// rounding of the transformed copy, relative to the size of the mesh and to how far it is from the origin.
+static bool IsSameGeometryInstance(const GeometryInstanceSource &a, const GeometryInstanceSource &b, bool rigid) {
+	if (!rigid)
+		return a.points == b.points && a.normals == b.normals;
+
+	const double tolerance = std::max(a.radius, b.radius) * 1e-5 + std::max(a.magnitude, b.magnitude) * 1e-6;
+	if (std::abs(a.radius - b.radius) > tolerance)
+		return false;
+
+	const auto match = [](const std::vector<pxr::GfVec3f> &u, const std::vector<pxr::GfVec3f> &v, double max_error) {
+		for (size_t i = 0; i < u.size(); ++i)
+			for (int k = 0; k < 3; ++k)
+				if (std::abs(double(u[i][k]) - double(v[i][k])) > max_error)
+					return false;
+		return true;
+	};
+	return match(a.points, b.points, tolerance) && match(a.normals, b.normals, 1e-4);
+}
+
+// Transform from the geometry of the mesh at source to the mesh at frame, with the translation in meters.
+static hg::Mat4 GetRigidOffset(const RigidFrame &source, const RigidFrame &frame, float meters_per_unit) {
+	double r[3][3], t[3];
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j)
+			r[i][j] = frame.axes[0][i] * source.axes[0][j] + frame.axes[1][i] * source.axes[1][j] + frame.axes[2][i] * source.axes[2][j];
+		t[i] = (frame.origin[i] - (r[i][0] * source.origin[0] + r[i][1] * source.origin[1] + r[i][2] * source.origin[2])) * meters_per_unit;
+	}
+
+	return hg::Mat4(float(r[0][0]), float(r[1][0]), float(r[2][0]), float(r[0][1]), float(r[1][1]), float(r[2][1]), float(r[0][2]), float(r[1][2]),
+		float(r[2][2]), float(t[0]), float(t[1]), float(t[2]));
+}
+
+// Memory held by a geometry waiting to be written.
+static size_t GetGeometryMemorySize(const hg::Geometry &geo) {
+	size_t size = geo.vtx.size() * sizeof(hg::Vec3) + geo.pol.size() * sizeof(hg::Geometry::Polygon) + geo.binding.size() * sizeof(uint32_t) +
+				  geo.normal.size() * sizeof(hg::Vec3) + geo.color.size() * sizeof(hg::Color) + geo.tangent.size() * sizeof(hg::Geometry::TangentFrame) +
+				  geo.skin.size() * sizeof(hg::Geometry::Skin) + geo.bind_pose.size() * sizeof(hg::Mat4);
+	for (const auto &uv : geo.uv)
+		size += uv.size() * sizeof(hg::Vec2);
+	return size;
+}
+
+// Render-ready geometries (-optimize-mesh). The model builder splits the polygons by material into fans of triangles and makes a GPU
+// vertex of each distinct combination of vertex and polygon-vertex attributes, in the order they are first used. The optimization works on
+// these GPU vertices: polygons are split into triangles ordered for the post-transform vertex cache then in clusters to reduce overdraw,
+// and vertices are welded and numbered in the order they are first used.
+
+// Merge the vertices with identical position and skin.
+static void WeldVertices(hg::Geometry &geo) {
+	const size_t count = geo.vtx.size();
+	const bool skinned = geo.skin.size() == count;
+
+	const auto less = [&](uint32_t a, uint32_t b) {
+		if (const int c = memcmp(&geo.vtx[a], &geo.vtx[b], sizeof(hg::Vec3)))
+			return c < 0;
+		if (skinned)
+			if (const int c = memcmp(&geo.skin[a], &geo.skin[b], sizeof(hg::Geometry::Skin)))
+				return c < 0;
+		return false;
+	};
+
+	std::vector<uint32_t> order(count), remap(count);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), less);
+
+	for (size_t i = 0; i < count; ++i)
+		remap[order[i]] = i && !less(order[i - 1], order[i]) ? remap[order[i - 1]] : order[i];
+
+	for (auto &v : geo.binding)
+		v = remap[v];
+}
+
+// Order triangles for the post-transform vertex cache, from "Linear-Speed Vertex Cache Optimisation" (Tom Forsyth). indices holds three
+// vertices per triangle, returns the triangles in drawing order.
+static std::vector<uint32_t> OrderTrianglesForVertexCache(const std::vector<uint32_t> &indices, size_t vertex_count) {
+	constexpr int cache_size = 32;
+
+	const size_t tri_count = indices.size() / 3;
+
+	// triangles using each vertex
+	std::vector<uint32_t> offsets(vertex_count + 1, 0), vtx_tris(indices.size());
+	for (const auto v : indices)
+		++offsets[v + 1];
+	for (size_t v = 0; v < vertex_count; ++v)
+		offsets[v + 1] += offsets[v];
+	{
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); ++i)
+			vtx_tris[fill[indices[i]]++] = uint32_t(i / 3);
+	}
+
+	std::vector<uint32_t> remaining(vertex_count);
+	for (size_t v = 0; v < vertex_count; ++v)
+		remaining[v] = offsets[v + 1] - offsets[v];
+
+	std::vector<int> cache_pos(vertex_count, -1);
+	std::vector<float> vtx_score(vertex_count);
+	std::vector<uint8_t> added(tri_count, 0);
+
+	const auto score = [&](uint32_t v) {
+		if (!remaining[v])
+			return -1.f;
+		float s = 0.f;
+		const int pos = cache_pos[v];
+		if (pos >= 0)
+			s = pos < 3 ? 0.75f : std::pow(1.f - float(pos - 3) / float(cache_size - 3), 1.5f);
+		return s + 2.f / std::sqrt(float(remaining[v]));
+	};
+
+	for (size_t v = 0; v < vertex_count; ++v)
+		vtx_score[v] = score(uint32_t(v));
+
+	std::vector<uint32_t> order, cache, next_cache;
+	order.reserve(tri_count);
+
+	int64_t best = -1;
+	for (size_t cursor = 0; order.size() < tri_count;) {
+		if (best < 0) { // nothing left around the cache, continue with the next triangle in input order
+			while (added[cursor])
+				++cursor;
+			best = int64_t(cursor);
+		}
+
+		const auto t = uint32_t(best);
+		order.push_back(t);
+		added[t] = 1;
+
+		// the triangle vertices move to the front of the cache
+		next_cache.assign(indices.begin() + t * 3, indices.begin() + t * 3 + 3);
+		for (const auto v : next_cache) {
+			--remaining[v];
+			const auto end = offsets[v] + remaining[v];
+			for (auto i = offsets[v]; i <= end; ++i)
+				if (vtx_tris[i] == t) {
+					std::swap(vtx_tris[i], vtx_tris[end]); // keep the triangles left to add first
+					break;
+				}
+		}
+		for (const auto v : cache)
+			if (v != next_cache[0] && v != next_cache[1] && v != next_cache[2])
+				next_cache.push_back(v);
+
+		for (size_t i = cache_size; i < next_cache.size(); ++i) {
+			cache_pos[next_cache[i]] = -1;
+			vtx_score[next_cache[i]] = score(next_cache[i]);
+		}
+		next_cache.resize(std::min(next_cache.size(), size_t(cache_size)));
+		for (size_t i = 0; i < next_cache.size(); ++i) {
+			cache_pos[next_cache[i]] = int(i);
+			vtx_score[next_cache[i]] = score(next_cache[i]);
+		}
+		std::swap(cache, next_cache);
+
+		// update the triangles left around the cache and pick the best one
+		best = -1;
+		float best_score = -1.f;
+		for (const auto v : cache)
+			for (auto i = offsets[v]; i < offsets[v] + remaining[v]; ++i) {
+				const auto u = vtx_tris[i];
+				const auto s = vtx_score[indices[u * 3]] + vtx_score[indices[u * 3 + 1]] + vtx_score[indices[u * 3 + 2]];
+				if (s > best_score) {
+					best_score = s;
+					best = u;
+				}
+			}
+	}
+	return order;
+}
+
+// Reorder triangles to reduce overdraw, from "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander, Nehab, Barczak).
+// The vertex cache order is split in clusters where it restarts, the clusters facing away from the mesh center are drawn first as they
+// are the most likely to hide the others.
+static void OrderClustersForOverdraw(std::vector<uint32_t> &order, const std::vector<uint32_t> &indices, const std::vector<hg::Vec3> &positions) {
+	constexpr size_t cache_size = 16;
+
+	std::vector<size_t> cluster_starts;
+	{
+		std::deque<uint32_t> fifo;
+		for (size_t i = 0; i < order.size(); ++i) {
+			int misses = 0;
+			for (int k = 0; k < 3; ++k) {
+				const auto v = indices[order[i] * 3 + k];
+				if (std::find(fifo.begin(), fifo.end(), v) == fifo.end()) {
+					++misses;
+					fifo.push_back(v);
+					if (fifo.size() > cache_size)
+						fifo.pop_front();
+				}
+			}
+			if (!i || misses == 3)
+				cluster_starts.push_back(i);
+		}
+	}
+	if (cluster_starts.size() < 2)
+		return;
+	cluster_starts.push_back(order.size());
+
+	const auto triangle = [&](uint32_t t, hg::Vec3 &a, hg::Vec3 &b, hg::Vec3 &c) {
+		a = positions[indices[t * 3]];
+		b = positions[indices[t * 3 + 1]];
+		c = positions[indices[t * 3 + 2]];
+	};
+
+	hg::Vec3 center(0.f, 0.f, 0.f);
+	float area = 0.f;
+	for (const auto t : order) {
+		hg::Vec3 a, b, c;
+		triangle(t, a, b, c);
+		const float w = hg::Len(hg::Cross(b - a, c - a));
+		center = center + (a + b + c) * w;
+		area += w;
+	}
+	if (area <= 0.f)
+		return;
+	center = center * (1.f / (area * 3.f));
+
+	struct Cluster {
+		size_t start, end;
+		float sort_key;
+	};
+	std::vector<Cluster> clusters;
+	for (size_t i = 0; i + 1 < cluster_starts.size(); ++i) {
+		hg::Vec3 cluster_center(0.f, 0.f, 0.f), normal(0.f, 0.f, 0.f);
+		float cluster_area = 0.f;
+		for (size_t j = cluster_starts[i]; j < cluster_starts[i + 1]; ++j) {
+			hg::Vec3 a, b, c;
+			triangle(order[j], a, b, c);
+			const auto n = hg::Cross(b - a, c - a);
+			const float w = hg::Len(n);
+			cluster_center = cluster_center + (a + b + c) * w;
+			normal = normal + n;
+			cluster_area += w;
+		}
+		float sort_key = 0.f;
+		if (cluster_area > 0.f) {
+			cluster_center = cluster_center * (1.f / (cluster_area * 3.f));
+			const float l = hg::Len(normal);
+			if (l > 0.f)
+				sort_key = hg::Dot(cluster_center - center, normal * (1.f / l));
+		}
+		clusters.push_back({cluster_starts[i], cluster_starts[i + 1], sort_key});
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) { return a.sort_key > b.sort_key; });
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(order.size());
+	for (const auto &cluster : clusters)
+		sorted.insert(sorted.end(), order.begin() + cluster.start, order.begin() + cluster.end);
+	order.swap(sorted);
+}
+
+// Number the vertices in the order they are first used, unused vertices are dropped.
+static void NumberVerticesByFirstUse(hg::Geometry &geo) {
+	std::vector<uint32_t> remap(geo.vtx.size(), 0xffffffff);
+	std::vector<hg::Vec3> vtx;
+	std::vector<hg::Geometry::Skin> skin;
+	for (auto &v : geo.binding) {
+		if (remap[v] == 0xffffffff) {
+			remap[v] = uint32_t(vtx.size());
+			vtx.push_back(geo.vtx[v]);
+			if (!geo.skin.empty())
+				skin.push_back(geo.skin[v]);
+		}
+		v = remap[v];
+	}
+
+	geo.vtx.swap(vtx);
+	geo.skin.swap(skin);
+}
+
+template <typename T> static void PermuteCorners(std::vector<T> &values, const std::vector<uint32_t> &corners) {
+	if (values.empty())
+		return;
+	std::vector<T> permuted(corners.size());
+	for (size_t i = 0; i < corners.size(); ++i)
+		permuted[i] = values[corners[i]];
+	values.swap(permuted);
+}
+
+// Polygon-vertex attributes are either missing or complete and the vertices are in range.
+static bool HasConsistentAttributes(const hg::Geometry &geo) {
+	const size_t corner_count = geo.binding.size();
+
+	bool valid = (geo.normal.empty() || geo.normal.size() == corner_count) && (geo.color.empty() || geo.color.size() == corner_count) &&
+				 (geo.tangent.empty() || geo.tangent.size() == corner_count) && (geo.skin.empty() || geo.skin.size() == geo.vtx.size());
+	for (const auto &uv : geo.uv)
+		valid = valid && (uv.empty() || uv.size() == corner_count);
+	for (const auto v : geo.binding)
+		valid = valid && v < geo.vtx.size();
+	return valid;
+}
+
+static void OptimizeGeometry(hg::Geometry &geo, const pxr::SdfPath &prim_path) {
+	TraceScope trace_scope("OptimizeGeometry", prim_path);
+
+	const size_t corner_count = geo.binding.size();
+
+	if (!HasConsistentAttributes(geo)) {
+		hg::warn(hg::format("Not optimizing geometry '%1', inconsistent attributes").arg(prim_path.GetString()));
+		return;
+	}
+
+	WeldVertices(geo);
+
+	// GPU vertex of each polygon-vertex, identified by the hash of its attributes. A collision only costs some cache efficiency.
+	std::vector<uint32_t> corner_vertex(corner_count), vertex_corner;
+	{
+		FlatMap<uint64_t, uint32_t> vertices;
+		for (size_t c = 0; c < corner_count; ++c) {
+			uint64_t h = HashBytes(&geo.binding[c], sizeof(uint32_t), 0x243f6a8885a308d3ull);
+			if (!geo.normal.empty())
+				h = HashBytes(&geo.normal[c], sizeof(hg::Vec3), h);
+			if (!geo.color.empty())
+				h = HashBytes(&geo.color[c], sizeof(hg::Color), h);
+			if (!geo.tangent.empty())
+				h = HashBytes(&geo.tangent[c], sizeof(hg::Geometry::TangentFrame), h);
+			for (const auto &uv : geo.uv)
+				if (!uv.empty())
+					h = HashBytes(&uv[c], sizeof(hg::Vec2), h);
+
+			const auto i = vertices.Insert(h, uint32_t(vertex_corner.size()));
+			if (i.second)
+				vertex_corner.push_back(uint32_t(c));
+			corner_vertex[c] = *i.first;
+		}
+	}
+
+	std::vector<hg::Vec3> vertex_positions(vertex_corner.size());
+	for (size_t v = 0; v < vertex_corner.size(); ++v)
+		vertex_positions[v] = geo.vtx[geo.binding[vertex_corner[v]]];
+
+	// triangle fans per material, as split by the model builder
+	std::map<uint8_t, std::vector<uint32_t>> material_triangles; // three polygon-vertices per triangle
+	{
+		size_t corner = 0;
+		for (const auto &pol : geo.pol) {
+			auto &triangles = material_triangles[pol.material];
+			for (uint32_t k = 1; k + 1 < pol.vtx_count; ++k)
+				triangles.insert(triangles.end(), {uint32_t(corner), uint32_t(corner + k), uint32_t(corner + k + 1)});
+			corner += pol.vtx_count;
+		}
+	}
+
+	std::vector<hg::Geometry::Polygon> pol;
+	std::vector<uint32_t> corners; // source polygon-vertex of each polygon-vertex of the optimized geometry
+	for (const auto &i : material_triangles) {
+		const auto &triangles = i.second;
+
+		std::vector<uint32_t> indices(triangles.size());
+		for (size_t k = 0; k < triangles.size(); ++k)
+			indices[k] = corner_vertex[triangles[k]];
+
+		auto order = OrderTrianglesForVertexCache(indices, vertex_corner.size());
+		OrderClustersForOverdraw(order, indices, vertex_positions);
+
+		for (const auto t : order) {
+			pol.push_back({3, i.first});
+			corners.insert(corners.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+		}
+	}
+
+	geo.pol.swap(pol);
+	PermuteCorners(geo.binding, corners);
+	PermuteCorners(geo.normal, corners);
+	PermuteCorners(geo.color, corners);
+	PermuteCorners(geo.tangent, corners);
+	for (auto &uv : geo.uv)
+		PermuteCorners(uv, corners);
+
+	const auto vtx_count = geo.vtx.size();
+	NumberVerticesByFirstUse(geo);
+
+	hg::debug(hg::format("	Optimized geometry '%1': %2 vertices welded to %3").arg(prim_path.GetString()).arg(vtx_count).arg(geo.vtx.size()));
+}
+
+// Level of detail chains (-lod-count). Each level is saved next to its geometry as <name>.lod<level>.geo, <name>.lod.json lists the levels
+// starting from the geometry itself: {"levels": [{"triangles": count, "error": distance}, ...]}. The error is an estimate in meters of the
+// largest distance from a simplified surface to the original one.
+struct LodLevel {
+	hg::Geometry geo;
+	size_t triangles{0};
+	float error{0.f};
+};
+
+// Quadric error metric of a vertex, sum of the squared distances to the planes of its triangles weighted by their area. The symmetric
+// 4x4 matrix is stored as its 10 coefficients.
+struct Quadric {
+	double a[10]{};
+	double w{0.}; // total weight, to express the error as a distance
+
+	void AddPlane(const hg::Vec3 &n, float d, double weight) {
+		const double p[4] = {n.x, n.y, n.z, d};
+		for (int i = 0, k = 0; i < 4; ++i)
+			for (int j = i; j < 4; ++j)
+				a[k++] += p[i] * p[j] * weight;
+		w += weight;
+	}
+
+	void Add(const Quadric &q) {
+		for (int k = 0; k < 10; ++k)
+			a[k] += q.a[k];
+		w += q.w;
+	}
+
+	double Evaluate(const hg::Vec3 &v) const {
+		const double x = v.x, y = v.y, z = v.z;
+		return a[0] * x * x + 2. * a[1] * x * y + 2. * a[2] * x * z + 2. * a[3] * x + a[4] * y * y + 2. * a[5] * y * z + 2. * a[6] * y + a[7] * z * z +
+			   2. * a[8] * z + a[9];
+	}
+};
+
+static bool SameCornerAttributes(const hg::Geometry &geo, uint32_t a, uint32_t b) {
+	bool same = (geo.normal.empty() || !memcmp(&geo.normal[a], &geo.normal[b], sizeof(hg::Vec3))) &&
+				(geo.color.empty() || !memcmp(&geo.color[a], &geo.color[b], sizeof(hg::Color))) &&
+				(geo.tangent.empty() || !memcmp(&geo.tangent[a], &geo.tangent[b], sizeof(hg::Geometry::TangentFrame)));
+	for (const auto &uv : geo.uv)
+		same = same && (uv.empty() || !memcmp(&uv[a], &uv[b], sizeof(hg::Vec2)));
+	return same;
+}
+
+// Simplify a geometry by quadric error half-edge collapses (Garland, Heckbert), a level is saved each time the triangle count reaches the
+// next target. A vertex only collapses onto a neighbor if its polygon-vertices all share the same attributes and material, vertices on
+// borders, attribute seams (uv, normal, ...) and material boundaries stay in place. Collapses flipping a triangle or moving a vertex onto
+// a differing normal are rejected.
+static std::vector<LodLevel> BuildLodLevels(const hg::Geometry &geo, int level_count, float ratio, const pxr::SdfPath &prim_path) {
+	TraceScope trace_scope("BuildLodLevels", prim_path);
+
+	std::vector<LodLevel> levels;
+	if (!HasConsistentAttributes(geo)) {
+		hg::warn(hg::format("Not simplifying geometry '%1', inconsistent attributes").arg(prim_path.GetString()));
+		return levels;
+	}
+
+	hg::Geometry base = geo;
+	WeldVertices(base);
+
+	const auto &vtx = base.vtx;
+	const size_t vtx_count = vtx.size();
+
+	// triangle fans, as split by the model builder, degenerate triangles are dropped
+	std::vector<uint32_t> tri_corners;
+	std::vector<uint8_t> tri_material;
+	{
+		size_t corner = 0;
+		for (const auto &pol : base.pol) {
+			for (uint32_t k = 1; k + 1 < pol.vtx_count; ++k) {
+				const uint32_t c[3] = {uint32_t(corner), uint32_t(corner + k), uint32_t(corner + k + 1)};
+				const auto a = base.binding[c[0]], b = base.binding[c[1]], d = base.binding[c[2]];
+				if (a == b || b == d || a == d)
+					continue;
+				tri_corners.insert(tri_corners.end(), c, c + 3);
+				tri_material.push_back(pol.material);
+			}
+			corner += pol.vtx_count;
+		}
+	}
+
+	const size_t tri_count = tri_material.size();
+	if (!tri_count)
+		return levels;
+
+	const auto tri_vtx = [&](size_t t, int k) { return base.binding[tri_corners[t * 3 + k]]; };
+	const auto tri_normal = [&](const hg::Vec3 &a, const hg::Vec3 &b, const hg::Vec3 &c) { return hg::Cross(b - a, c - a); };
+
+	std::vector<std::vector<uint32_t>> vtx_tris(vtx_count); // may hold removed triangles
+	std::vector<uint8_t> tri_alive(tri_count, 1), locked(vtx_count, 0), removed(vtx_count, 0);
+	std::vector<Quadric> quadrics(vtx_count);
+	std::vector<uint32_t> vtx_corner(vtx_count, 0xffffffff); // first polygon-vertex of each vertex
+	std::vector<int> vtx_material(vtx_count, -1);
+
+	FlatMap<uint64_t, uint32_t> edge_use;
+	for (size_t t = 0; t < tri_count; ++t) {
+		const auto &a = vtx[tri_vtx(t, 0)], &b = vtx[tri_vtx(t, 1)], &c = vtx[tri_vtx(t, 2)];
+		auto n = tri_normal(a, b, c);
+		const float l = hg::Len(n);
+
+		for (int k = 0; k < 3; ++k) {
+			const auto v = tri_vtx(t, k), corner = tri_corners[t * 3 + k];
+			vtx_tris[v].push_back(uint32_t(t));
+
+			if (l > 0.f)
+				quadrics[v].AddPlane(n * (1.f / l), -hg::Dot(n * (1.f / l), a), l * 0.5);
+
+			if (vtx_corner[v] == 0xffffffff)
+				vtx_corner[v] = corner;
+			else if (!SameCornerAttributes(base, vtx_corner[v], corner))
+				locked[v] = 1;
+
+			if (vtx_material[v] < 0)
+				vtx_material[v] = tri_material[t];
+			else if (vtx_material[v] != tri_material[t])
+				locked[v] = 1;
+
+			const uint64_t e0 = tri_vtx(t, k), e1 = tri_vtx(t, (k + 1) % 3);
+			++edge_use[std::min(e0, e1) << 32 | std::max(e0, e1)];
+		}
+	}
+
+	// edges not shared by exactly two triangles are borders or non-manifold
+	for (size_t t = 0; t < tri_count; ++t)
+		for (int k = 0; k < 3; ++k) {
+			const uint64_t e0 = tri_vtx(t, k), e1 = tri_vtx(t, (k + 1) % 3);
+			if (*edge_use.Find(std::min(e0, e1) << 32 | std::max(e0, e1)) != 2)
+				locked[e0] = locked[e1] = 1;
+		}
+
+	// polygon-vertex of v in a live triangle using both u and v
+	const auto find_edge_corner = [&](uint32_t u, uint32_t v, int &shared) {
+		uint32_t corner = 0xffffffff;
+		shared = 0;
+		for (const auto t : vtx_tris[u]) {
+			if (!tri_alive[t])
+				continue;
+			for (int k = 0; k < 3; ++k)
+				if (tri_vtx(t, k) == v) {
+					corner = tri_corners[t * 3 + k];
+					++shared;
+				}
+		}
+		return corner;
+	};
+
+	std::vector<uint32_t> ring_u, ring_v;
+	const auto ring = [&](uint32_t u, std::vector<uint32_t> &out) {
+		out.clear();
+		for (const auto t : vtx_tris[u])
+			if (tri_alive[t])
+				for (int k = 0; k < 3; ++k)
+					if (tri_vtx(t, k) != u)
+						out.push_back(tri_vtx(t, k));
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	};
+
+	const auto can_collapse = [&](uint32_t u, uint32_t v) {
+		int shared;
+		const auto v_corner = find_edge_corner(u, v, shared);
+		if (shared != 2)
+			return false;
+
+		if (!base.normal.empty() && hg::Dot(base.normal[vtx_corner[u]], base.normal[v_corner]) < 0.8f)
+			return false;
+
+		// link condition, the only common neighbors of u and v are the vertices opposite to their edge
+		ring(u, ring_u);
+		ring(v, ring_v);
+		size_t common = 0;
+		for (size_t i = 0, j = 0; i < ring_u.size() && j < ring_v.size();)
+			if (ring_u[i] < ring_v[j])
+				++i;
+			else if (ring_v[j] < ring_u[i])
+				++j;
+			else
+				++common, ++i, ++j;
+		if (common != 2)
+			return false;
+
+		for (const auto t : vtx_tris[u]) {
+			if (!tri_alive[t] || tri_vtx(t, 0) == v || tri_vtx(t, 1) == v || tri_vtx(t, 2) == v)
+				continue;
+			hg::Vec3 p[3], q[3];
+			for (int k = 0; k < 3; ++k) {
+				p[k] = vtx[tri_vtx(t, k)];
+				q[k] = tri_vtx(t, k) == u ? vtx[v] : p[k];
+			}
+			const auto n0 = tri_normal(p[0], p[1], p[2]), n1 = tri_normal(q[0], q[1], q[2]);
+			const float l0 = hg::Len(n0), l1 = hg::Len(n1);
+			if (l1 <= 0.f || hg::Dot(n0, n1) < 0.2f * l0 * l1)
+				return false;
+		}
+		return true;
+	};
+
+	struct Candidate {
+		double cost;
+		uint32_t u, v, version;
+		bool operator<(const Candidate &o) const { return cost > o.cost; } // cheapest first
+	};
+	std::priority_queue<Candidate> queue;
+	std::vector<uint32_t> version(vtx_count, 0);
+
+	// cheapest valid collapse of u, validated again when popped as the collapses around u change its neighborhood
+	const auto queue_vertex = [&](uint32_t u) {
+		++version[u];
+		if (locked[u] || removed[u])
+			return;
+
+		double best = std::numeric_limits<double>::max();
+		uint32_t best_v = 0;
+		for (const auto t : vtx_tris[u])
+			if (tri_alive[t])
+				for (int k = 0; k < 3; ++k) {
+					const auto v = tri_vtx(t, k);
+					if (v == u)
+						continue;
+					Quadric q = quadrics[u];
+					q.Add(quadrics[v]);
+					const double cost = std::max(q.Evaluate(vtx[v]), 0.) / std::max(q.w, 1e-12);
+					if (cost < best && can_collapse(u, v)) {
+						best = cost;
+						best_v = v;
+					}
+				}
+		if (best < std::numeric_limits<double>::max())
+			queue.push({best, u, best_v, version[u]});
+	};
+
+	for (uint32_t u = 0; u < vtx_count; ++u)
+		queue_vertex(u);
+
+	size_t alive = tri_count;
+	double max_error = 0.;
+	std::vector<uint32_t> neighbors;
+
+	for (int level = 0; level < level_count; ++level) {
+		const auto target = size_t(double(tri_count) * std::pow(double(ratio), level + 1));
+
+		while (alive > target && !queue.empty()) {
+			const auto candidate = queue.top();
+			queue.pop();
+
+			const auto u = candidate.u, v = candidate.v;
+			if (removed[u] || removed[v] || candidate.version != version[u])
+				continue;
+
+			if (!can_collapse(u, v)) {
+				queue_vertex(u);
+				continue;
+			}
+
+			int shared;
+			const auto v_corner = find_edge_corner(u, v, shared);
+
+			for (const auto t : vtx_tris[u]) {
+				if (!tri_alive[t])
+					continue;
+				if (tri_vtx(t, 0) == v || tri_vtx(t, 1) == v || tri_vtx(t, 2) == v) {
+					tri_alive[t] = 0;
+					--alive;
+					continue;
+				}
+				for (int k = 0; k < 3; ++k)
+					if (tri_vtx(t, k) == u)
+						tri_corners[t * 3 + k] = v_corner;
+				vtx_tris[v].push_back(t);
+			}
+
+			quadrics[v].Add(quadrics[u]);
+			removed[u] = 1;
+			vtx_tris[u].clear();
+			max_error = std::max(max_error, candidate.cost);
+
+			// the collapses around v changed
+			ring(v, neighbors);
+			neighbors.push_back(v);
+			for (const auto w : neighbors)
+				queue_vertex(w);
+		}
+
+		if (levels.empty() ? alive == tri_count : alive == levels.back().triangles)
+			break; // nothing left to simplify
+
+		LodLevel lod;
+		lod.geo = base;
+		lod.geo.pol.clear();
+
+		std::vector<uint32_t> corners;
+		for (size_t t = 0; t < tri_count; ++t)
+			if (tri_alive[t]) {
+				lod.geo.pol.push_back({3, tri_material[t]});
+				corners.insert(corners.end(), tri_corners.begin() + t * 3, tri_corners.begin() + t * 3 + 3);
+			}
+
+		PermuteCorners(lod.geo.binding, corners);
+		PermuteCorners(lod.geo.normal, corners);
+		PermuteCorners(lod.geo.color, corners);
+		PermuteCorners(lod.geo.tangent, corners);
+		for (auto &uv : lod.geo.uv)
+			PermuteCorners(uv, corners);
+		NumberVerticesByFirstUse(lod.geo);
+
+		lod.triangles = alive;
+		lod.error = float(std::sqrt(max_error));
+		levels.push_back(std::move(lod));
+	}
+
+	hg::debug(hg::format("	Simplified geometry '%1': %2 triangles, %3 levels").arg(prim_path.GetString()).arg(tri_count).arg(levels.size()));
+	return levels;
+}
+
+// Half float, rounded to nearest even.
+static uint16_t FloatToHalf(float f) {
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+
+	const uint32_t sign = (x >> 16) & 0x8000, mant = x & 0x7fffff;
+	const int exp = int((x >> 23) & 0xff) - 127 + 15;
+
+	if (((x >> 23) & 0xff) == 0xff)
+		return uint16_t(sign | 0x7c00 | (mant ? 0x200 : 0)); // infinity or NaN
+	if (exp >= 31)
+		return uint16_t(sign | 0x7c00);
+
+	uint32_t h, rem, half;
+	if (exp <= 0) { // subnormal
+		if (exp < -10)
+			return uint16_t(sign);
+		const uint32_t shift = uint32_t(14 - exp);
+		h = (mant | 0x800000) >> shift;
+		rem = (mant | 0x800000) & ((1u << shift) - 1);
+		half = 1u << (shift - 1);
+	} else {
+		h = (uint32_t(exp) << 10) | (mant >> 13);
+		rem = mant & 0x1fff;
+		half = 0x1000;
+	}
+	if (rem > half || (rem == half && (h & 1)))
+		++h; // may carry into the exponent, which is the correct rounding
+	return uint16_t(sign | h);
+}
+
+static float HalfToFloat(uint16_t h) {
+	const int exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+	float f;
+	if (!exp)
+		f = std::ldexp(float(mant), -24);
+	else if (exp == 31)
+		f = mant ? std::numeric_limits<float>::quiet_NaN() : std::numeric_limits<float>::infinity();
+	else
+		f = std::ldexp(float(mant | 0x400), exp - 25);
+	return h & 0x8000 ? -f : f;
+}
+
+static hg::Vec3 DecodeOctahedral(int16_t x, int16_t y) {
+	hg::Vec3 n(std::max(x / 32767.f, -1.f), std::max(y / 32767.f, -1.f), 0.f);
+	n.z = 1.f - std::abs(n.x) - std::abs(n.y);
+	if (n.z < 0.f) {
+		const float ox = n.x;
+		n.x = (1.f - std::abs(n.y)) * (ox >= 0.f ? 1.f : -1.f);
+		n.y = (1.f - std::abs(ox)) * (n.y >= 0.f ? 1.f : -1.f);
+	}
+	return hg::Normalize(n);
+}
+
+// Octahedral encoding of a unit vector to two snorm16, keeping the rounding of the coordinates closest to the vector once decoded.
+static std::array<int16_t, 2> EncodeOctahedral(const hg::Vec3 &n) {
+	const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (!(l1 > 0.f))
+		return {0, 0};
+
+	float x = n.x / l1, y = n.y / l1;
+	if (n.z < 0.f) {
+		const float ox = x;
+		x = (1.f - std::abs(y)) * (ox >= 0.f ? 1.f : -1.f);
+		y = (1.f - std::abs(ox)) * (y >= 0.f ? 1.f : -1.f);
+	}
+
+	const auto unit = hg::Normalize(n);
+	std::array<int16_t, 2> best{};
+	float best_dot = -2.f;
+	for (int k = 0; k < 4; ++k) {
+		const auto qx = int16_t(std::clamp((k & 1 ? std::ceil(x * 32767.f) : std::floor(x * 32767.f)), -32767.f, 32767.f));
+		const auto qy = int16_t(std::clamp((k & 2 ? std::ceil(y * 32767.f) : std::floor(y * 32767.f)), -32767.f, 32767.f));
+		const float d = hg::Dot(DecodeOctahedral(qx, qy), unit);
+		if (d > best_dot) {
+			best_dot = d;
+			best = {qx, qy};
+		}
+	}
+	return best;
+}
+
+// Quantized geometry saved next to the .geo by -quantize-geometry. All values are little-endian:
+//	char magic[4] = "HGQG", uint32 version = 1
+//	uint32 vertex count, uint32 polygon count, uint32 binding count (polygon-vertices), uint32 index size (2 or 4)
+//	uint32 attributes: 1 normal, 2 tangent, 4 color, 8 skin, bit 8 + i uv channel i
+//	float aabb min[3], max[3]
+//	float error bounds: position (meters, per axis), normal and tangent (radians), uv
+//	uint16 position[vertex count][3], unorm over the aabb
+//	uint8 polygon[polygon count][2] (vertex count, material)
+//	index binding[binding count]
+//	per binding, if present: int16 normal[2] octahedral snorm, int16 tangent[2][2] (T, B) octahedral snorm, uint8 color[4],
+//	uint16 uv[channel][2] half floats, in channel order
+//	if skinned: skin[vertex count] (uint16 index[4], uint8 weight[4]), uint32 bind pose count, float bind pose[count][3][4] (hg::Mat4)
+static std::string QuantizeGeometry(const hg::Geometry &geo, const std::string &name) {
+	TraceScope trace_scope("QuantizeGeometry");
+
+	const size_t vtx_count = geo.vtx.size(), binding_count = geo.binding.size();
+	const bool has_normal = geo.normal.size() == binding_count, has_tangent = geo.tangent.size() == binding_count,
+			   has_color = geo.color.size() == binding_count, has_skin = geo.skin.size() == vtx_count && vtx_count;
+
+	uint32_t attributes = (has_normal ? 1 : 0) | (has_tangent ? 2 : 0) | (has_color ? 4 : 0) | (has_skin ? 8 : 0);
+	for (size_t i = 0; i < geo.uv.size(); ++i)
+		if (geo.uv[i].size() == binding_count && binding_count)
+			attributes |= 1u << (8 + i);
+
+	hg::Vec3 mn(0.f, 0.f, 0.f), mx(0.f, 0.f, 0.f);
+	if (vtx_count) {
+		mn = mx = geo.vtx[0];
+		for (const auto &v : geo.vtx) {
+			mn = hg::Min(mn, v);
+			mx = hg::Max(mx, v);
+		}
+	}
+
+	std::string data("HGQG", 4);
+	const auto put = [&data](const void *p, size_t size) { data.append(reinterpret_cast<const char *>(p), size); };
+	const auto put_u32 = [&put](uint32_t v) { put(&v, sizeof(v)); };
+
+	put_u32(1);
+	put_u32(uint32_t(vtx_count));
+	put_u32(uint32_t(geo.pol.size()));
+	put_u32(uint32_t(binding_count));
+	const uint32_t index_size = vtx_count <= 0x10000 ? 2 : 4;
+	put_u32(index_size);
+	put_u32(attributes);
+	put(&mn, sizeof(float) * 3);
+	put(&mx, sizeof(float) * 3);
+
+	const size_t errors_offset = data.size();
+	float errors[4] = {}; // position, normal, tangent, uv
+	put(errors, sizeof(errors));
+
+	// positions
+	const hg::Vec3 extent = mx - mn;
+	const auto step = [](float e) { return e > 0.f ? e / 65535.f : 0.f; };
+	const float step_x = step(extent.x), step_y = step(extent.y), step_z = step(extent.z);
+	const auto quantize = [](float v, float mn, float step) { return step > 0.f ? uint16_t(std::clamp(std::lround((v - mn) / step), 0l, 65535l)) : uint16_t(0); };
+	for (const auto &v : geo.vtx) {
+		const uint16_t q[3] = {quantize(v.x, mn.x, step_x), quantize(v.y, mn.y, step_y), quantize(v.z, mn.z, step_z)};
+		put(q, sizeof(q));
+		errors[0] = std::max({errors[0], std::abs(mn.x + q[0] * step_x - v.x), std::abs(mn.y + q[1] * step_y - v.y), std::abs(mn.z + q[2] * step_z - v.z)});
+	}
+
+	for (const auto &pol : geo.pol)
+		put(&pol, 2);
+
+	for (const auto i : geo.binding)
+		if (index_size == 2) {
+			const auto i16 = uint16_t(i);
+			put(&i16, sizeof(i16));
+		} else
+			put(&i, sizeof(i));
+
+	const auto angle = [](const hg::Vec3 &a, const hg::Vec3 &b) { return std::acos(std::clamp(hg::Dot(hg::Normalize(a), b), -1.f, 1.f)); };
+	const auto put_direction = [&](const hg::Vec3 &v, float &error) {
+		const auto q = EncodeOctahedral(v);
+		put(q.data(), sizeof(int16_t) * 2);
+		if (hg::Len2(v) > 0.f)
+			error = std::max(error, angle(v, DecodeOctahedral(q[0], q[1])));
+	};
+
+	if (has_normal)
+		for (const auto &n : geo.normal)
+			put_direction(n, errors[1]);
+
+	if (has_tangent)
+		for (const auto &t : geo.tangent) {
+			put_direction(t.T, errors[2]);
+			put_direction(t.B, errors[2]);
+		}
+
+	if (has_color)
+		for (const auto &c : geo.color) {
+			const uint8_t q[4] = {uint8_t(std::lround(std::clamp(c.r, 0.f, 1.f) * 255.f)), uint8_t(std::lround(std::clamp(c.g, 0.f, 1.f) * 255.f)),
+				uint8_t(std::lround(std::clamp(c.b, 0.f, 1.f) * 255.f)), uint8_t(std::lround(std::clamp(c.a, 0.f, 1.f) * 255.f))};
+			put(q, sizeof(q));
+		}
+
+	for (size_t i = 0; i < geo.uv.size(); ++i)
+		if (attributes & (1u << (8 + i)))
+			for (const auto &uv : geo.uv[i]) {
+				const uint16_t q[2] = {FloatToHalf(uv.x), FloatToHalf(uv.y)};
+				put(q, sizeof(q));
+				errors[3] = std::max({errors[3], std::abs(HalfToFloat(q[0]) - uv.x), std::abs(HalfToFloat(q[1]) - uv.y)});
+			}
+
+	if (has_skin) {
+		for (const auto &skin : geo.skin) {
+			put(skin.index.data(), sizeof(uint16_t) * 4);
+			put(skin.weight.data(), sizeof(uint8_t) * 4);
+		}
+		put_u32(uint32_t(geo.bind_pose.size()));
+		for (const auto &m : geo.bind_pose)
+			put(m.m, sizeof(m.m));
+	}
+
+	memcpy(data.data() + errors_offset, errors, sizeof(errors));
+
+	hg::debug(hg::format("	Quantized geometry '%1': %2 to %3 bytes, error position %4 m, normal %5°, tangent %6°, uv %7")
+				  .arg(name)
+				  .arg(GetGeometryMemorySize(geo))
+				  .arg(data.size())
+				  .arg(errors[0])
+				  .arg(errors[1] * 180.f / hg::Pi)
+				  .arg(errors[2] * 180.f / hg::Pi)
+				  .arg(errors[3]));
+	return data;
+}
+
+// Queue the write of a .geo geometry and, when quantize is set, of its .qgeo next to it. They are stored in the content cache under name and
+// under name with the .qgeo extension. The scene models reference the .geo, which is what the Harfang toolchain reads.
+static void WriteGeometry(
+	const std::string &path, hg::Geometry &&geo, const std::string &cache_key, const std::string &name, bool quantize, const pxr::SdfPath &prim_path) {
+	if (quantize) {
+		const auto qgeo_path = hg::CutFileExtension(path) + ".qgeo";
+		auto data = QuantizeGeometry(geo, qgeo_path);
+		const auto size = data.size();
+		output_writer.Write(qgeo_path, size, [data = std::move(data), cache_key, name = name.substr(0, name.size() - 3) + "qgeo"](const std::string &path) {
+			{
+				std::ofstream file(path, std::ios::binary);
+				file.write(data.data(), data.size());
+				if (!file)
+					return false;
+			}
+			if (!cache_key.empty())
+				content_cache.StoreFile(cache_key, name, path);
+			return true;
+		});
+	}
+
+	const auto size = GetGeometryMemorySize(geo);
+	output_writer.Write(path, size, [geo = std::move(geo), cache_key, name, prim_path](const std::string &path) {
+		TraceScope trace_scope("SaveGeometryToFile", prim_path);
+		if (!hg::SaveGeometryToFile(path.c_str(), geo))
+			return false;
+
+		if (!cache_key.empty())
+			content_cache.StoreFile(cache_key, name, path);
+		return true;
+	});
+}
+
+// Path of a level of detail file next to a geometry.
+static std::string GetLodPath(const std::string &geo_path, const std::string &ext) { return hg::CutFileExtension(geo_path) + ".lod" + ext; }
+
+static size_t GetTriangleCount(const hg::Geometry &geo) {
+	size_t count = 0;
+	for (const auto &pol : geo.pol)
+		count += pol.vtx_count >= 3 ? pol.vtx_count - 2 : 0;
+	return count;
+}
+
+// Queue the level files of a geometry and its level list, they are added to the content cache with the geometry.
+static void SaveLodLevels(const std::string &geo_path, std::vector<LodLevel> &&levels, size_t triangles, const std::string &cache_key, bool quantize,
+	const pxr::SdfPath &prim_path) {
+	json list = json::array();
+	list.push_back({{"triangles", triangles}, {"error", 0.f}});
+
+	for (size_t i = 0; i < levels.size(); ++i) {
+		auto &lod = levels[i];
+		list.push_back({{"triangles", lod.triangles}, {"error", lod.error}});
+
+		const auto ext = std::to_string(i + 1) + ".geo";
+		WriteGeometry(GetLodPath(geo_path, ext), std::move(lod.geo), cache_key, "lod" + ext, quantize, prim_path);
+	}
+
+	const json lods = {{"levels", list}};
+	output_writer.Write(GetLodPath(geo_path, ".json"), lods.dump(1, '\t'));
+	if (!cache_key.empty())
+		content_cache.Store(cache_key, "lod.json", [text = lods.dump(1, '\t')](const std::string &path) {
+			std::ofstream file(path, std::ios::binary);
+			file.write(text.data(), text.size());
+			return bool(file);
+		});
+}
+
+// Find the level files of a cached geometry, returns false if any is missing.
+static bool FindCachedLodLevels(const std::string &cache_key, bool quantize, std::vector<std::pair<std::string, std::string>> &files) {
+	std::string list_path;
+	if (!content_cache.Find(cache_key, "lod.json", list_path))
+		return false;
+
+	std::ifstream file(list_path);
+	const auto lods = json::parse(file, nullptr, false);
+	if (!lods.is_object() || !lods.contains("levels") || !lods["levels"].is_array() || lods["levels"].empty())
+		return false;
+
+	files = {{list_path, ".json"}};
+	for (size_t i = 1; i < lods["levels"].size(); ++i) {
+		for (const auto &ext : {std::to_string(i) + ".geo", std::to_string(i) + ".qgeo"}) {
+			if (ext.ends_with(".qgeo") && !quantize)
+				continue;
+			std::string path;
+			if (!content_cache.Find(cache_key, "lod" + ext, path))
+				return false;
+			files.push_back({path, ext});
+		}
+	}
+	return true;
+}
+
+static void ConvertGeometry(const GeometryJob &job, const Config &config) {
+	MeshSource mesh;
+	if (job.mesh)
+		mesh = *job.mesh;
+	else
+		ReadMeshSource(job.prim, job.uvMapVarname, job.skin.get(), mesh);
+
+	if (job.bounds)
+		ComputeGeometryBounds(mesh.extent, mesh.points, mesh.metersPerUnit, *job.bounds);
+
+	// a geometry converted from the same source by a previous run only has to be copied
+	std::string cache_key;
+	if (content_cache.IsOpen() && job.save) {
+		cache_key = ComputeMeshSourceSHA1(mesh, GetGeometryCacheSalt(config));
+
+		std::string cached_path, cached_qgeo_path;
+		std::vector<std::pair<std::string, std::string>> cached_lods;
+		if (content_cache.Find(cache_key, "geo", cached_path) && (!config.quantize_geometry || content_cache.Find(cache_key, "qgeo", cached_qgeo_path)) &&
+			(config.lod_count <= 0 || FindCachedLodLevels(cache_key, config.quantize_geometry, cached_lods))) {
+			hg::debug(hg::format("Geometry '%1' found in cache").arg(job.path));
+			output_writer.Write(job.path, 0, [cached_path](const std::string &path) { return CopyFileFast(cached_path, path); });
+			if (config.quantize_geometry)
+				output_writer.Write(hg::CutFileExtension(job.path) + ".qgeo", 0,
+					[cached_qgeo_path](const std::string &path) { return CopyFileFast(cached_qgeo_path, path); });
+			for (const auto &lod : cached_lods)
+				output_writer.Write(GetLodPath(job.path, lod.second), 0, [cached_path = lod.first](const std::string &path) { return CopyFileFast(cached_path, path); });
+			return;
+		}
+	}
+
+	hg::Geometry geo;
+	ExportGeometry(mesh, geo);
+
+	if (!mesh.isSubset) {
+		std::vector<hg::Vec3> vtx_normal;
+		{
+			TraceScope trace_scope("ComputeVertexNormal", mesh.path);
+			const auto vtx_to_pol = hg::ComputeVertexToPolygon(geo);
+			vtx_normal = hg::ComputeVertexNormal(geo, vtx_to_pol, hg::Deg(45.f));
+		}
+
+		// Recalculate the vertex normals.
+		bool recalculate_normal = config.recalculate_normal;
+		if (geo.normal.empty())
+			recalculate_normal = true;
+
+		if (recalculate_normal) {
+			hg::debug("    - Recalculate normals");
+			geo.normal = vtx_normal;
+		} else
+			vtx_normal = geo.normal;
+
+		// Recalculate the vertex tangent frame.
+		bool recalculate_tangent = config.recalculate_tangent;
+		if (geo.tangent.empty())
+			recalculate_tangent = true;
+		else if (geo.tangent.size() != geo.normal.size()) { // be sure tangent is same size of normal, some strange things can happen with multiple
+			hg::debug("CAREFUL Normal and Tangent are not the same size, can happen if you have submesh (some with tangent and some without)");
+			geo.tangent.resize(geo.normal.size());
+		}
+
+		if (recalculate_tangent) {
+			hg::debug("    - Recalculate tangent frames (MikkT)");
+			if (!geo.uv[0].empty()) {
+				TraceScope trace_scope("ComputeVertexTangent", mesh.path);
+				geo.tangent = hg::ComputeVertexTangent(geo, vtx_normal, 0, hg::Deg(45.f));
+			}
+		}
+	}
+
+	if (job.save) {
+		std::vector<LodLevel> lods;
+		if (config.lod_count > 0)
+			lods = BuildLodLevels(geo, config.lod_count, config.lod_ratio, mesh.path);
+
+		if (config.optimize_mesh) {
+			OptimizeGeometry(geo, mesh.path);
+			for (auto &lod : lods)
+				OptimizeGeometry(lod.geo, mesh.path);
+		}
+
+		if (config.lod_count > 0)
+			SaveLodLevels(job.path, std::move(lods), GetTriangleCount(geo), cache_key, config.quantize_geometry, mesh.path);
+
+		hg::debug(hg::format("Export geometry to '%1'").arg(job.path));
+		WriteGeometry(job.path, std::move(geo), cache_key, "geo", config.quantize_geometry, mesh.path);
+	}
+}
+
+// Create the object of a Mesh or GeomSubset prim and queue the conversion of its geometry. The offset of the exported object is the
+// transform to apply to the geometry when it is shared with a mesh differing by a rigid transform.
+static ExportedObject ExportObject(const pxr::UsdPrim &p, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+	ExportedObject exported;
+	auto &object = exported.object;
+
+	const auto hashIdentifierPrim = GetPrimIdentity(p);
+
+	//auto j = p.GetPrimIndex().DumpToString();
+	//auto d = p.GetPrimIndex().GetNodeRange().DumpToString();
+	/*auto m = pxr::TfStringify(p.GetPrimIndex().GetRootNode().GetLayerStack());
+	auto j=p.GetPrimIndex().GetRootNode().GetLayerStack()->GetLayers();
+	auto k = p.GetPrimIndex().GetRootNode().GetLayerStack()->GetLayers()[0]->GetDisplayName();
+*/
+	const auto skin = FindSkinBinding(p);
+
+	// If the geometry is not found, import it.
+	if (!primToObject.Find(hashIdentifierPrim, exported)) {
+		GeometryJob job;
+		job.prim = p;
+		job.skin = skin;
+
+		object = GetObjectWithMaterial(p, job.uvMapVarname, scene, config, resources, skin != nullptr);
+
+		// the geometry of a mesh with the same content is shared, a mesh with children only matches without transform as they would be moved
+		// along with it. A skinned geometry is not shared, its influences and bind pose are not part of the key.
+		std::string instance_key;
+		GeometryInstanceSource instance;
+		if (config.detect_geometry_instances && !skin) {
+			job.mesh.emplace();
+			ReadMeshSource(p, job.uvMapVarname, nullptr, *job.mesh);
+
+			bool rigid = p.GetChildren().empty();
+			instance_key = ComputeGeometryInstanceKey(*job.mesh, rigid, instance);
+
+			const auto &candidates = geometry_instances[instance_key];
+			const auto i = std::find_if(
+				candidates.begin(), candidates.end(), [&](const GeometryInstanceSource &source) { return IsSameGeometryInstance(source, instance, rigid); });
+			if (i != candidates.end()) {
+				hg::debug(hg::format("Geometry of '%1' is an instance of '%2'").arg(p.GetPath().GetString()).arg(i->path));
+
+				object.SetModelRef(i->model);
+				if (rigid)
+					exported.offset = GetRigidOffset(i->frame, instance.frame, job.mesh->metersPerUnit);
+				exported.bounds = i->bounds;
+
+				primToObject.Set(hashIdentifierPrim, exported);
+				return exported;
+			}
+		}
+
+		const bool up_to_date = incremental.enabled && UpdateGeometryManifest(p, job.uvMapVarname, GetGeometryCacheSalt(config));
+
+		std::string path = p.GetPath().GetString();
+		job.save = GetOutputPath(path, config.base_output_path, path, {}, "geo", GetIncrementalPolicy(config.import_policy_geometry, up_to_date));
+		job.path = path;
+
+		path = MakeRelativeResourceName(path, config.prj_path, config.prefix);
+		object.SetModelRef(resources.models.Add(path.c_str(), {}));
+
+		if (config.scene_bvh) {
+			job.bounds = &geometry_bounds.emplace_back();
+			exported.bounds = job.bounds;
+		}
+
+		if (!instance_key.empty()) {
+			instance.model = object.GetModelRef();
+			instance.path = p.GetPath().GetString();
+			instance.bounds = exported.bounds;
+			geometry_instances[instance_key].push_back(std::move(instance));
+		}
+
+		primToObject.Set(hashIdentifierPrim, exported);
+
+		// bones are set once the joints of the skeleton are created
+		if (skin)
+			scene_skeletons[&scene].objects.push_back({object, skin->skeleton});
+
+		if (up_to_date && hg::Exists(job.path.c_str())) {
+			hg::debug(hg::format("Geometry '%1' is up to date").arg(job.path));
+			if (job.bounds)
+				geometry_pool.Queue([p, bounds = job.bounds]() { ReadGeometryBounds(p, *bounds); });
+		} else
+			geometry_pool.Queue([job = std::move(job), &config]() { ConvertGeometry(job, config); });
+	}	
+
+	return exported;
+}
+
+static void ExportCamera(const pxr::UsdPrim &p, hg::Node *nodeParent, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+	auto camera = scene.CreateCamera();
+	nodeParent->SetCamera(camera);
+
+	auto cameraUSD = pxr::UsdGeomCamera(p);
+
+	pxr::GfVec2f clippingRange;
+	cameraUSD.GetClippingRangeAttr().Get(&clippingRange);
+	camera.SetZNear(clippingRange[0]);
+	camera.SetZFar(clippingRange[1]);
+
+	pxr::TfToken projAttr;
+	cameraUSD.GetProjectionAttr().Get(&projAttr);
+	if (projAttr == pxr::UsdGeomTokens->orthographic) {
+		camera.SetIsOrthographic(true);
+	}else {
+		float fov;
+		cameraUSD.GetVerticalApertureAttr().Get(&fov);
+		camera.SetFov(hg::Deg(fov));
+		camera.SetIsOrthographic(false);
+	}	
+}
+
+static void ExportLight(const pxr::UsdPrim &p, const pxr::TfToken type, hg::Node *nodeParent, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+	auto light = scene.CreateLight();
+	nodeParent->SetLight(light);
+	pxr::UsdLuxBoundableLightBase lightUSD;
+	if (type == "SphereLight") {
+		pxr::UsdLuxSphereLight sphereLight(p);
+		lightUSD = (pxr::UsdLuxBoundableLightBase)sphereLight;
+		light.SetType(hg::LT_Point);
+
+		float radiusAttr;
+		sphereLight.GetRadiusAttr().Get(&radiusAttr);
+		light.SetRadius(radiusAttr);
+
+	} else if (type == "DistantLight") {
+		pxr::UsdLuxDistantLight distantLight(p);
+		lightUSD = (pxr::UsdLuxBoundableLightBase)distantLight;
+		light.SetType(hg::LT_Spot);
+
+		float angleAttr;
+		distantLight.GetAngleAttr().Get(&angleAttr);
+		light.SetRadius(angleAttr);
+
+	} else if (type == "DomeLight") {
+		pxr::UsdLuxDomeLight domeLight(p);
+		lightUSD = (pxr::UsdLuxBoundableLightBase)domeLight;
+	}	
+	
+	// add common value
+	if (type == "SphereLight" || type == "DistantLight" || type == "DomeLight") {
+		pxr::GfVec3f colorAttr;
+		lightUSD.GetColorAttr().Get(&colorAttr);
+		light.SetDiffuseColor(hg::Color(colorAttr.data()[0], colorAttr.data()[1], colorAttr.data()[2]));
+	}		
+}
+
+static hg::Mat4 GetXFormMat(const pxr::UsdPrim& p, pxr::UsdTimeCode time = pxr::UsdTimeCode::Default()) {
+	auto xForm = pxr::UsdGeomXformable(p);
+	pxr::GfMatrix4d transform;
+	bool resetsXformStack;
+	xForm.GetLocalTransformation(&transform, &resetsXformStack, time);
+
+	hg::Mat4 m(transform.data()[0], transform.data()[1], transform.data()[2], transform.data()[4], transform.data()[5], transform.data()[6], transform.data()[8],
+		transform.data()[9], transform.data()[10], transform.data()[12], transform.data()[13], transform.data()[14]);
+
+	auto t = hg::GetT(m) * pxr::UsdGeomGetStageMetersPerUnit(p.GetStage());
+	hg::SetT(m, t);
+
+	return m;
+}
+
+// Local matrix of the node of a prim at a time. The transform of a root prim is turned to the Y-axis up and scaled, a camera is turned to
+// look down the Harfang camera axis. post, the transform of the node content, is applied last.
+static hg::Mat4 GetNodeMatrix(const pxr::UsdPrim &p, bool root, pxr::UsdTimeCode time, const hg::Mat4 &post, const Config &config) {
+	hg::Mat4 m = GetXFormMat(p, time);
+
+	// If there is no parent, modify the base matrix.
+	if (root) {
+		// Rotate the transform to account for the Z-axis as the up direction.
+		if (UsdGeomGetStageUpAxis(p.GetStage()) == pxr::UsdGeomTokens->z) {
+			hg::Mat44 to_hg(1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 1.f);
+
+			auto xForm = pxr::UsdGeomXformable(p);
+			pxr::GfMatrix4d transform;
+			bool resetsXformStack;
+			xForm.GetLocalTransformation(&transform, &resetsXformStack, time);
+
+			hg::Mat44 m44(transform.data()[0], transform.data()[1], transform.data()[2], transform.data()[3], transform.data()[4], transform.data()[5],
+				transform.data()[6], transform.data()[7], transform.data()[8], transform.data()[9], transform.data()[10], transform.data()[11],
+				transform.data()[12], transform.data()[13], transform.data()[14], transform.data()[15]);
+
+			m44 = to_hg * m44;
+
+			hg::Mat4 mt(m44.m[0][0], m44.m[1][0], m44.m[2][0], m44.m[0][1], m44.m[1][1], m44.m[2][1], m44.m[0][2], m44.m[1][2], m44.m[2][2], m44.m[0][3],
+				m44.m[1][3], m44.m[2][3]);
+			m = mt;
+		}
+		auto s = hg::GetS(m) * config.geometry_scale;
+		hg::SetS(m, s);
+	}
+
+	// Camera
+	if (p.GetTypeName() == "Camera") {
+		m = m * hg::Mat4(hg::RotationMatX(hg::Pi)) * hg::Mat4(hg::RotationMatZ(hg::Pi));
+		auto s = hg::GetS(m);
+		hg::SetS(m, hg::Vec3(-s.x, s.y, s.z));
+	}
+
+	return m * post;
+}
+
+// Transform animation of a node, sampled from the xform time samples of its prim or the joint animation of its skeleton by the geometry
+// workers.
+struct TransformAnimation {
+	std::string path; // prim path, or skeleton path followed by the joint path
+	hg::NodeRef node;
+	hg::Anim anim; // no track if the transform is not animated
+};
+
+// Animations of the nodes of each scene being exported, added to the scene when it is saved. The sampling jobs of a scene are grouped so that
+// a prototype scene does not wait for the jobs of the other scenes.
+struct SceneAnimations {
+	std::deque<TransformAnimation> nodes;
+	WorkerPool::Group sampling;
+};
+
+std::map<const hg::Scene *, SceneAnimations> transform_animations;
+
+// Keyframe reduction (Ramer-Douglas-Peucker): a sample is dropped if the interpolation between the keys kept around it is within
+// tolerance. error(a, b, i) is the distance from sample i to the interpolation of samples a and b at its time. Returns the kept samples.
+template <typename E> static std::vector<uint32_t> ReduceKeys(size_t count, E error, float tolerance) {
+	std::vector<uint8_t> keep(count, 0);
+	keep.front() = keep.back() = 1;
+
+	std::vector<std::pair<uint32_t, uint32_t>> segments = {{0, uint32_t(count - 1)}};
+	while (!segments.empty()) {
+		const auto [a, b] = segments.back();
+		segments.pop_back();
+
+		float max_error = tolerance;
+		uint32_t split = 0;
+		for (auto i = a + 1; i < b; ++i)
+			if (const float e = error(a, b, i); e > max_error) {
+				max_error = e;
+				split = i;
+			}
+
+		if (split) {
+			keep[split] = 1;
+			segments.push_back({a, split});
+			segments.push_back({split, b});
+		}
+	}
+
+	std::vector<uint32_t> kept;
+	for (uint32_t i = 0; i < count; ++i)
+		if (keep[i])
+			kept.push_back(i);
+	return kept;
+}
+
+// Decompose the local matrices of a node at each time sample to reduced Position, Rotation and Scale tracks.
+static void ReduceTransformSamples(
+	const std::vector<double> &times, double time_codes_per_second, const std::vector<hg::Mat4> &mats, const Config &config, hg::Anim &anim) {
+	const size_t count = times.size();
+	std::vector<hg::time_ns> t(count);
+	std::vector<hg::Vec3> position(count), scale(count);
+	std::vector<hg::Quaternion> rotation(count);
+
+	for (size_t i = 0; i < count; ++i) {
+		hg::Mat3 r;
+		hg::Decompose(mats[i], &position[i], &r, &scale[i]);
+		rotation[i] = hg::QuaternionFromMatrix3(r);
+		if (i && hg::Dot(rotation[i], rotation[i - 1]) < 0.f) // stay on the hemisphere of the previous key, slerp takes the short way
+			rotation[i] = hg::Quaternion(-rotation[i].x, -rotation[i].y, -rotation[i].z, -rotation[i].w);
+
+		t[i] = hg::time_ns(std::llround(times[i] / time_codes_per_second * 1e9));
+	}
+
+	const auto factor = [&](uint32_t a, uint32_t b, uint32_t i) { return t[b] > t[a] ? float(double(t[i] - t[a]) / double(t[b] - t[a])) : 0.f; };
+	const auto lerp_error = [&](const std::vector<hg::Vec3> &v) {
+		return [&](uint32_t a, uint32_t b, uint32_t i) { return hg::Len(v[a] + (v[b] - v[a]) * factor(a, b, i) - v[i]); };
+	};
+	const auto slerp_error = [&](uint32_t a, uint32_t b, uint32_t i) {
+		const float d = std::min(std::abs(hg::Dot(hg::Slerp(rotation[a], rotation[b], factor(a, b, i)), rotation[i])), 1.f);
+		return 2.f * std::acos(d);
+	};
+
+	const auto add_track = [&](auto &tracks, const char *target, const auto &values, const std::vector<uint32_t> &kept) {
+		tracks.emplace_back();
+		tracks.back().target = target;
+		for (const auto i : kept)
+			tracks.back().keys.push_back({t[i], values[i]});
+	};
+
+	anim.t_start = t.front();
+	anim.t_end = t.back();
+	add_track(anim.vec3_tracks, "Position", position, ReduceKeys(count, lerp_error(position), config.anim_tolerance));
+	add_track(anim.quat_tracks, "Rotation", rotation, ReduceKeys(count, slerp_error, config.anim_tolerance));
+	add_track(anim.vec3_tracks, "Scale", scale, ReduceKeys(count, lerp_error(scale), config.anim_tolerance));
+}
+
+static void SampleTransformAnimation(const pxr::UsdPrim &p, bool root, const hg::Mat4 &post, const Config &config, hg::Anim &anim) {
+	TraceScope trace_scope("SampleTransformAnimation", p.GetPath());
+
+	std::vector<double> times;
+	pxr::UsdGeomXformable(p).GetTimeSamples(&times);
+	if (times.size() < 2)
+		return;
+
+	std::vector<hg::Mat4> mats(times.size());
+	for (size_t i = 0; i < times.size(); ++i)
+		mats[i] = GetNodeMatrix(p, root, times[i], post, config);
+
+	ReduceTransformSamples(times, p.GetStage()->GetTimeCodesPerSecond(), mats, config, anim);
+}
+
+// Queue the sampling of the transform animation of a node, the prim is read before any payload it belongs to is unloaded.
+static void QueueTransformAnimation(const pxr::UsdPrim &p, const hg::Node &node, bool root, const hg::Mat4 &post, const hg::Scene &scene, const Config &config) {
+	if (!pxr::UsdGeomXformable(p).TransformMightBeTimeVarying())
+		return;
+
+	auto &animations = transform_animations[&scene];
+	animations.nodes.push_back({p.GetPath().GetString(), node.ref, {}});
+	geometry_pool.Queue(
+		[p, root, post, &anim = animations.nodes.back().anim, &config]() { SampleTransformAnimation(p, root, post, config, anim); }, animations.sampling);
+}
+
+static json AnimToJson(const hg::Anim &anim) {
+	json tracks = json::array();
+	for (const auto &track : anim.vec3_tracks) {
+		json keys = json::array();
+		for (const auto &key : track.keys)
+			keys.push_back({key.t, key.v.x, key.v.y, key.v.z});
+		tracks.push_back({{"target", track.target}, {"keys", keys}});
+	}
+
+	json quat_tracks = json::array();
+	for (const auto &track : anim.quat_tracks) {
+		json keys = json::array();
+		for (const auto &key : track.keys)
+			keys.push_back({key.t, key.v.x, key.v.y, key.v.z, key.v.w});
+		quat_tracks.push_back({{"target", track.target}, {"keys", keys}});
+	}
 
-		json meta_opacityTexture_json = {{"profiles", {{"default", {{"compression", "BC7"}, {"preprocess", {{"construct", {(int)(diffuse.x * 255), (int)(diffuse.y * 255), (int)(diffuse.z * 255), {{"path", resources.textures.GetName(opacityTexture)}, {"channel", "A"}}}}}}}}}}};
-		auto meta_opacityTexture = meta_opacityTexture_json.dump();
+	return {{"t_start", anim.t_start}, {"t_end", anim.t_end}, {"vec3_tracks", tracks}, {"quat_tracks", quat_tracks}};
+}
 
-		if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(opacityTexture), {}, "meta", config.import_policy_texture)) {
-			if (std::FILE *f = std::fopen(dst_path.c_str(), "w")) {
-				std::fwrite(meta_opacityTexture.data(), sizeof meta_opacityTexture[0], meta_opacityTexture.size(), f);
-				std::fclose(f);
-			}
-		}
+// Add the transform animations of a scene as a scene animation, or save them to <name>.anim.json with -anim-to-file. The animation file
+// holds the scene animation with its node animations, nodes are identified by the path of their prim, joints by the path of their skeleton
+// followed by their joint path:
+// {"name", "t_start", "t_end", "frame_duration", "node_anims": [{"node": prim path, "anim": {"t_start", "t_end", "vec3_tracks", "quat_tracks"}}]}
+// with the keys of a track saved as [t, x, y, z] (Position, Scale) or [t, x, y, z, w] (Rotation), times in nanoseconds. Returns true if the
+// scene has animated transforms.
+static bool AddTransformAnimations(hg::Scene &scene, const std::string &name, const Config &config) {
+	const auto i = transform_animations.find(&scene);
+	if (i == transform_animations.end())
+		return false;
 
-		mat.textures["uBaseOpacityMap"] = {opacityTexture, 0};
+	i->second.sampling.Wait();
+
+	hg::SceneAnim scene_anim;
+	scene_anim.name = name;
+	scene_anim.frame_duration = hg::time_from_sec_f(1.f / float(std::max(config.frame_per_second, 1)));
+	scene_anim.t_start = std::numeric_limits<hg::time_ns>::max();
+	scene_anim.t_end = std::numeric_limits<hg::time_ns>::min();
+
+	json node_anims = json::array();
+	for (auto &animation : i->second.nodes) {
+		if (animation.anim.vec3_tracks.empty())
+			continue;
+
+		scene_anim.t_start = std::min(scene_anim.t_start, animation.anim.t_start);
+		scene_anim.t_end = std::max(scene_anim.t_end, animation.anim.t_end);
+
+		if (config.anim_to_file)
+			node_anims.push_back({{"node", animation.path}, {"anim", AnimToJson(animation.anim)}});
+		else
+			scene_anim.node_anims.push_back({animation.node, scene.AddAnim(animation.anim)});
 	}
+	transform_animations.erase(i);
 
-	// Check if there is an ORM (Occlusion, Roughness, Metallic).
-	if (occlusionTexture != hg::InvalidTextureRef || roughnessTexture != hg::InvalidTextureRef || metallicTexture != hg::InvalidTextureRef) {
-		json preprocess;
+	if (scene_anim.t_start > scene_anim.t_end)
+		return false; // no animated transform
 
-		auto metallicRoughnessTexture =
-			occlusionTexture != hg::InvalidTextureRef ? occlusionTexture : (roughnessTexture != hg::InvalidTextureRef ? roughnessTexture : metallicTexture);
+	hg::debug(hg::format("Exporting %1 transform animation(s) of '%2'").arg(config.anim_to_file ? node_anims.size() : scene_anim.node_anims.size()).arg(name));
 
-		if (occlusionTexture != roughnessTexture || roughnessTexture != metallicTexture || metallicTexture != occlusionTexture) {
-			json occlusionJSON;
-			if (occlusionTexture != hg::InvalidTextureRef)
-				occlusionJSON = resources.textures.GetName(occlusionTexture);
-			else
-				occlusionJSON = (int)orm.x * 255;
-			json roughnessJSON;
-			if (roughnessTexture != hg::InvalidTextureRef)
-				roughnessJSON = resources.textures.GetName(roughnessTexture);
-			else
-				roughnessJSON = (int)orm.y * 255;
-			json metallicJSON;
-			if (metallicTexture != hg::InvalidTextureRef)
-				metallicJSON = resources.textures.GetName(metallicTexture);
-			else
-				metallicJSON = (int)orm.z * 255;
-			preprocess = {"preprocess", {{"construct", {occlusionJSON, roughnessJSON, metallicJSON}}}};
-		}
+	if (!config.anim_to_file) {
+		scene.AddSceneAnim(scene_anim);
+		return true;
+	}
 
-		json meta_occlusionTexture_json = {{"profiles", {{"default", {{"compression", "BC7"}, preprocess}}}}};
-		auto meta_occlusionTexture = meta_occlusionTexture_json.dump();
+	std::string path;
+	if (GetOutputPath(path, config.base_output_path, name, {}, "anim.json", GetIncrementalPolicy(config.import_policy_anim, !incremental.HasChanges()))) {
+		const json file = {{"name", name}, {"t_start", scene_anim.t_start}, {"t_end", scene_anim.t_end}, {"frame_duration", scene_anim.frame_duration},
+			{"node_anims", node_anims}};
+		output_writer.Write(path, file.dump());
+	}
+	return true;
+}
 
-		if (GetOutputPath(dst_path, config.prj_path, resources.textures.GetName(metallicRoughnessTexture), {}, "meta", config.import_policy_texture)) {
-			if (std::FILE *f = std::fopen(dst_path.c_str(), "w")) {
-				std::fwrite(meta_occlusionTexture.data(), sizeof meta_occlusionTexture[0], meta_occlusionTexture.size(), f);
-				std::fclose(f);
-			}
+// Set the bones of the skinned objects of a scene to the joints of their skeleton.
+static void BindSkinnedObjects(hg::Scene &scene) {
+	const auto i = scene_skeletons.find(&scene);
+	if (i == scene_skeletons.end())
+		return;
+
+	for (auto &[object, skeleton] : i->second.objects) {
+		const auto joints = i->second.joints.find(skeleton);
+		if (joints == i->second.joints.end()) {
+			hg::warn(hg::format("Skeleton '%1' is not exported, skinned object left without bones").arg(skeleton.GetString()));
+			continue;
 		}
-		mat.textures["uOcclusionRoughnessMetalnessMap"] = {metallicRoughnessTexture, 1};
+
+		object.SetBoneCount(joints->second.size());
+		for (size_t k = 0; k < joints->second.size(); ++k)
+			object.SetBone(k, joints->second[k]);
 	}
+	scene_skeletons.erase(i);
+}
 
-	mat.values["uBaseOpacityColor"] = {bgfx::UniformType::Vec4, {diffuse.x, diffuse.y, diffuse.z, diffuse.w}};
-	mat.values["uOcclusionRoughnessMetalnessColor"] = {bgfx::UniformType::Vec4, {orm.x, orm.y, orm.z, orm.w}};
-	mat.values["uSelfColor"] = {bgfx::UniformType::Vec4, {emissive.x, emissive.y, emissive.z, emissive.w}};
+// Transforms and bounded nodes of each scene being exported, with -scene-bvh. Nodes are created after their parent, the world matrices are
+// computed in node order when the scene is saved.
+struct SceneBounds {
+	struct Node {
+		uint32_t parent{0xffffffff};
+		hg::Mat4 local{hg::Mat4::Identity};
+	};
+	std::vector<Node> nodes; // by node index, identity for the nodes not recorded
+	std::vector<std::pair<uint32_t, const GeometryBounds *>> objects;
+	std::vector<std::pair<uint32_t, std::string>> instances; // instanced scene, as referenced by the instance
+};
 
-	if (opacityTexture != hg::InvalidTextureRef || diffuse.w < 1)
-		SetMaterialBlendMode(mat, hg::BM_Alpha);
+std::map<const hg::Scene *, SceneBounds> scene_bounds;
 
-	if (!config.shader.empty())
-		shader = config.shader; // Use the overridden shader if provided.
+// World matrices of the bounded nodes of a saved scene, the BVH is built once the geometry workers are done.
+struct FinishedSceneBounds {
+	std::string name; // as referenced by the instances of the scene
+	std::string bvh_path; // empty if the scene is not written
+	std::vector<std::tuple<uint32_t, hg::Mat4, const GeometryBounds *>> objects;
+	std::vector<std::tuple<uint32_t, hg::Mat4, std::string>> instances;
+};
 
-	hg::debug(hg::format("		- Using pipeline shader '%1'").arg(shader));
-	mat.program = resources.programs.Add(shader.c_str(), {});
+std::vector<FinishedSceneBounds> finished_scene_bounds; // instanced scenes are finished before the scenes instancing them
 
-	// FinalizeMaterial(mat, fbx_material->GetName(), geo_name);
-	return mat;
-}
+static void RecordNodeBounds(const hg::Scene &scene, const hg::Node &node, const hg::Node *parent, const hg::Mat4 &local, const GeometryBounds *bounds,
+	const std::string &instance_scene) {
+	auto &recorded = scene_bounds[&scene];
 
-#define __PolIndex (pol_index[p] + v)
-#define __PolRemapIndex (pol_index[p] + (geo.pol[p].vtx_count - 1 - v))
+	if (recorded.nodes.size() <= node.ref.idx)
+		recorded.nodes.resize(node.ref.idx + 1);
+	recorded.nodes[node.ref.idx] = {parent ? parent->ref.idx : 0xffffffff, local};
 
-static void ExportGeometry(
-	const pxr::UsdGeomMesh &geoMesh, const pxr::UsdGeomSubset *geoMeshSubSet, hg::Geometry &geo, const std::set<pxr::TfToken> &uvMapVarname) {
-	pxr::VtArray<pxr::GfVec3f> points;
-	pxr::VtArray<pxr::GfVec3f> normals;
-	std::vector<pxr::VtArray<pxr::GfVec2f>> uvs;
-	pxr::VtArray<int> faceVertexCounts;
-	pxr::VtArray<int> faceVertexIndices;
-	pxr::VtArray<int> faceSubsetIndices;
+	if (bounds)
+		recorded.objects.push_back({node.ref.idx, bounds});
+	if (!instance_scene.empty())
+		recorded.instances.push_back({node.ref.idx, instance_scene});
+}
 
-	// vertices
-	geoMesh.GetPointsAttr().Get(&points);
-	geo.vtx.resize(points.size());
-	memcpy(geo.vtx.data(), points.data(), geo.vtx.size() * sizeof(float) * 3);
+// The object of a mesh node is removed when the mesh is split in subsets.
+static void ClearNodeObjectBounds(const hg::Scene &scene, const hg::Node &node) {
+	auto &objects = scene_bounds[&scene].objects;
+	objects.erase(std::remove_if(objects.begin(), objects.end(), [&node](const auto &object) { return object.first == node.ref.idx; }), objects.end());
+}
 
-	// apply global scale from usd to be in meter
-	const auto globalScale = pxr::UsdGeomGetStageMetersPerUnit(geoMesh.GetPrim().GetStage());
-	for (auto &v : geo.vtx) {
-		v *= globalScale;
+static void FinishSceneBounds(const hg::Scene &scene, const std::string &name, const std::string &scene_path) {
+	FinishedSceneBounds finished;
+	finished.name = name;
+	if (!scene_path.empty())
+		finished.bvh_path = hg::CutFileExtension(scene_path) + ".bvh";
+
+	const auto i = scene_bounds.find(&scene);
+	if (i != scene_bounds.end()) {
+		const auto &nodes = i->second.nodes;
+		std::vector<hg::Mat4> world(nodes.size());
+		for (size_t k = 0; k < nodes.size(); ++k)
+			world[k] = nodes[k].parent < k ? world[nodes[k].parent] * nodes[k].local : nodes[k].local;
+
+		for (const auto &[node, bounds] : i->second.objects)
+			finished.objects.push_back({node, world[node], bounds});
+		for (const auto &[node, instance_scene] : i->second.instances)
+			finished.instances.push_back({node, world[node], instance_scene});
+		scene_bounds.erase(i);
 	}
 
-	// normals
-	geoMesh.GetNormalsAttr().Get(&normals);
+	finished_scene_bounds.push_back(std::move(finished));
+}
 
-	// faceVertexCounts
-	geoMesh.GetFaceVertexCountsAttr().Get(&faceVertexCounts);
+struct BVHItem {
+	hg::MinMax minmax;
+	hg::Vec3 centroid;
+	uint32_t node; // scene node index
+};
 
-	// faceVertexIndices
-	geoMesh.GetFaceVertexIndicesAttr().Get(&faceVertexIndices);
+struct BVHNode {
+	hg::MinMax minmax;
+	uint32_t offset{0}; // right child of an inner node, first item of a leaf
+	uint16_t count{0}; // items of a leaf, 0 for an inner node
+	uint16_t axis{0};
+};
 
-	// uv texcoord from blender (TODO test from other sources)
-	for (const auto &UVToken : uvMapVarname) {
-		auto UVPrim = pxr::UsdGeomPrimvar(geoMesh.GetPrim().GetAttribute(pxr::TfToken("primvars:"+UVToken.GetString())));
-		if (UVPrim.HasValue()) {
-			uvs.resize(uvs.size()+1);			
-			UVPrim.Get(&uvs.back());
-		}
+static float GetAxis(const hg::Vec3 &v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+
+static float GetSurfaceArea(const hg::MinMax &minmax) {
+	const auto d = minmax.mx - minmax.mn;
+	return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static hg::MinMax Union(const hg::MinMax &a, const hg::MinMax &b) { return {hg::Min(a.mn, b.mn), hg::Max(a.mx, b.mx)}; }
+
+// Build the subtree of items [first, first + count) by binned surface area heuristic, flattened depth first. Returns its root node.
+static uint32_t BuildBVHNode(std::vector<BVHItem> &items, size_t first, size_t count, std::vector<BVHNode> &nodes) {
+	const auto index = uint32_t(nodes.size());
+	nodes.emplace_back();
+
+	hg::MinMax minmax = items[first].minmax, centroids(items[first].centroid, items[first].centroid);
+	for (size_t i = first + 1; i < first + count; ++i) {
+		minmax = Union(minmax, items[i].minmax);
+		centroids = Union(centroids, {items[i].centroid, items[i].centroid});
 	}
-	// If a geometry subset exists, retrieve its indices.
-	if (geoMeshSubSet)
-		geoMeshSubSet->GetIndicesAttr().Get(&faceSubsetIndices);
+	nodes[index].minmax = minmax;
 
+	const auto make_leaf = [&]() {
+		nodes[index].offset = uint32_t(first);
+		nodes[index].count = uint16_t(count);
+		return index;
+	};
 
-	hg::debug(hg::format("	%1: geoMesh.points = %2\n").arg(__func__).arg(points.size()));
-	hg::debug(hg::format("		# of normals = %1\n").arg(normals.size()));
-	hg::debug(hg::format("		# of faceVertexCounts = %1\n").arg(faceVertexCounts.size()));
-	hg::debug(hg::format("		# of faceVertexIndices = %1\n").arg(faceVertexIndices.size()));
-	hg::debug(hg::format("		# of  nb uv = %1\n").arg(uvs.size()));
-	hg::debug(hg::format("		# of faceSubsetIndices = %1\n").arg(faceSubsetIndices.size()));
+	constexpr size_t max_leaf_items = 4;
+	if (count <= max_leaf_items)
+		return make_leaf();
 
-	size_t face_offset = 0;
-	for (size_t fid = 0; fid < faceVertexCounts.size(); fid++) {
-		int f_count = faceVertexCounts[fid];
+	const auto extent = centroids.mx - centroids.mn;
+	const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	const float lo = GetAxis(centroids.mn, axis), size = GetAxis(extent, axis);
 
-		assert(f_count >= 3);
+	// cost of splitting after each bin, against the cost of a leaf
+	constexpr int bin_count = 16;
+	size_t split = first + count / 2;
+	bool binned = false;
 
-		hg::Geometry::Polygon p{uint8_t(f_count), 0};
-		geo.pol.push_back(p);
+	if (size > 0.f) {
+		const auto bin_of = [&](const BVHItem &item) { return std::min(int((GetAxis(item.centroid, axis) - lo) / size * bin_count), bin_count - 1); };
 
-		for (size_t f = 0; f < f_count; f++) {
-			// indices
-			geo.binding.push_back(faceVertexIndices[face_offset + (f_count-1-f)]);
+		std::array<hg::MinMax, bin_count> bins;
+		std::array<size_t, bin_count> bin_items{};
+		for (size_t i = first; i < first + count; ++i) {
+			const int b = bin_of(items[i]);
+			bins[b] = bin_items[b]++ ? Union(bins[b], items[i].minmax) : items[i].minmax;
+		}
 
-			// normal x,y,z
-			if (normals.size()) {
-				int idx = face_offset + (f_count - 1 - f);
-				if (normals.size() == points.size())
-					idx = faceVertexIndices[face_offset + (f_count - 1 - f)];
+		std::array<float, bin_count> left_cost{};
+		hg::MinMax acc;
+		size_t acc_items = 0;
+		for (int b = 0; b < bin_count - 1; ++b) {
+			if (bin_items[b])
+				acc = acc_items ? Union(acc, bins[b]) : bins[b];
+			acc_items += bin_items[b];
+			left_cost[b] = acc_items ? GetSurfaceArea(acc) * float(acc_items) : 0.f;
+		}
 
-				hg::Vec3 n(normals[idx][0], normals[idx][1], normals[idx][2]);						
-					
-				geo.normal.push_back(n);
+		float best_cost = GetSurfaceArea(minmax) * float(count);
+		int best_bin = -1;
+		acc_items = 0;
+		for (int b = bin_count - 1; b > 0; --b) {
+			if (bin_items[b])
+				acc = acc_items ? Union(acc, bins[b]) : bins[b];
+			acc_items += bin_items[b];
+			if (acc_items == count || acc_items == 0)
+				continue;
+			const float cost = left_cost[b - 1] + GetSurfaceArea(acc) * float(acc_items);
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_bin = b;
 			}
+		}
 
-			// u, v
-			for (int i = 0; i < uvs.size(); ++i) {
-				const auto &uvUSD = uvs[i];
-				int idx = face_offset + (f_count - 1 - f);
-				if (normals.size() == points.size())
-					idx = faceVertexIndices[face_offset + (f_count - 1 - f)];
-			
-				hg::Vec2 uv(uvUSD[idx][0], uvUSD[idx][1]);
-				uv.y = 1.f - uv.y;
-				geo.uv[i].push_back(uv);
-			}
+		if (best_bin > 0) {
+			split = size_t(std::partition(items.begin() + first, items.begin() + first + count, [&](const BVHItem &item) { return bin_of(item) < best_bin; }) -
+						   items.begin());
+			binned = true;
+		} else if (count <= 4 * max_leaf_items)
+			return make_leaf(); // splitting does not pay
+	}
+
+	if (!binned) // same centroids or no split paying off, split in the middle
+		std::nth_element(items.begin() + first, items.begin() + split, items.begin() + first + count,
+			[axis](const BVHItem &a, const BVHItem &b) { return GetAxis(a.centroid, axis) < GetAxis(b.centroid, axis); });
+
+	nodes[index].axis = uint16_t(axis);
+	BuildBVHNode(items, first, split - first, nodes);
+	nodes[index].offset = BuildBVHNode(items, split, first + count - split, nodes);
+	return index;
+}
+
+// Bounding volume hierarchy of a scene saved next to it by -scene-bvh. All values are little-endian:
+//	char magic[4] = "HGBV", uint32 version = 1, uint32 node count, uint32 item count
+//	node[node count]: float min[3], float max[3], uint32 offset, uint16 item count, uint16 split axis. Nodes are in depth-first order, an inner
+//	node (item count 0) is followed by its left child and offset is its right child. The items of a leaf start at offset.
+//	uint32 item[item count]: index of a node in the saved scene, bounded by its geometry or its instanced scene in world space
+static std::string PackSceneBVH(const std::vector<BVHNode> &nodes, const std::vector<BVHItem> &items) {
+	std::string data("HGBV", 4);
+	const auto put = [&data](const void *p, size_t size) { data.append(reinterpret_cast<const char *>(p), size); };
+	const auto put_u32 = [&put](uint32_t v) { put(&v, sizeof(v)); };
+
+	put_u32(1);
+	put_u32(uint32_t(nodes.size()));
+	put_u32(uint32_t(items.size()));
+
+	for (const auto &node : nodes) {
+		const float minmax[6] = {node.minmax.mn.x, node.minmax.mn.y, node.minmax.mn.z, node.minmax.mx.x, node.minmax.mx.y, node.minmax.mx.z};
+		put(minmax, sizeof(minmax));
+		put_u32(node.offset);
+		put(&node.count, sizeof(node.count));
+		put(&node.axis, sizeof(node.axis));
+	}
+
+	for (const auto &item : items)
+		put_u32(item.node);
+	return data;
+}
+
+// Build and write the BVH of each finished scene, once the geometry bounds are known. An instance is bounded by the BVH root of its scene.
+static void WriteSceneBVHs() {
+	TraceScope trace_scope("WriteSceneBVHs");
+
+	std::map<std::string, hg::MinMax> scene_minmax;
+	for (const auto &finished : finished_scene_bounds) {
+		std::vector<BVHItem> items;
+		const auto add = [&items](const hg::MinMax &minmax, uint32_t node) { items.push_back({minmax, (minmax.mn + minmax.mx) * 0.5f, node}); };
+
+		for (const auto &[node, world, bounds] : finished.objects)
+			if (bounds && bounds->valid)
+				add(world * bounds->minmax, node);
+		for (const auto &[node, world, instance_scene] : finished.instances)
+			if (const auto i = scene_minmax.find(instance_scene); i != scene_minmax.end())
+				add(world * i->second, node);
+
+		std::vector<BVHNode> nodes;
+		if (!items.empty()) {
+			nodes.reserve(2 * items.size());
+			BuildBVHNode(items, 0, items.size(), nodes);
+			scene_minmax[finished.name] = nodes.front().minmax;
+		}
+
+		if (!finished.bvh_path.empty()) {
+			hg::debug(hg::format("Scene BVH '%1': %2 nodes over %3 items").arg(finished.bvh_path).arg(nodes.size()).arg(items.size()));
+			output_writer.Write(finished.bvh_path, PackSceneBVH(nodes, items));
 		}
-		face_offset += f_count;
+	}
+	finished_scene_bounds.clear();
+}
+
+//
+// Binary scenes use their own extension so that they are not mistaken for JSON scenes.
+static const char *GetSceneExtension(const Config &config) { return config.scene_format == SceneFormat::Binary ? "scnb" : "scn"; }
+
+static bool SaveScene(const std::string &path, const hg::Scene &scene, const hg::PipelineResources &resources, const Config &config) {
+	if (config.scene_format == SceneFormat::Binary) {
+		TraceScope trace_scope("SaveSceneBinaryToFile");
+		return hg::SaveSceneBinaryToFile(path.c_str(), scene, resources);
 	}
 
-	// If a subset exists, modify the geometry. TODO: This current method is not very efficient, consider optimization.
-	if (faceSubsetIndices.size() > 0) {
-		std::vector<hg::Geometry::Polygon> pol;
-		std::vector<uint32_t> binding;
-		std::vector<hg::Vec3> normal; // per-polygon-vertex
+	TraceScope trace_scope("SaveSceneJsonToFile");
+	return hg::SaveSceneJsonToFile(path.c_str(), scene, resources);
+}
 
-		std::array<hg::Geometry::UVSet, 8> uv; // per-polygon-vertex
+// Instance arrays saved by the point instancers of each scene being exported with -instancer-arrays, by instancer prim path.
+std::map<const hg::Scene *, json> scene_instance_arrays;
 
-		size_t face_offset = 0;
-		for (size_t i = 0; i < geo.pol.size(); ++i) {
-			// find if this poly is in the mesh
-			for (const auto &j: faceSubsetIndices)
-				if (i == j) {
-					pol.push_back(geo.pol[i]);
-					for (size_t f = 0; f < geo.pol[i].vtx_count; f++) {
-						// indices
-						binding.push_back(geo.binding[face_offset + f]);
+// List the instance arrays of a scene in <name>.instances.json, next to the scene:
+// {"instancers": [{"node": instancer prim path, "instances": resource name of its .instances file}]}
+static void SaveInstanceArrayList(const hg::Scene &scene, const std::string &name, const Config &config) {
+	const auto i = scene_instance_arrays.find(&scene);
+	if (i == scene_instance_arrays.end())
+		return;
 
-						// normal x,y,z
-						if (normals.size())
-							normal.push_back(geo.normal[face_offset + f]);
+	std::string path;
+	if (GetOutputPath(path, config.base_output_path, name, {}, "instances.json", GetIncrementalPolicy(config.import_policy_scene, !incremental.HasChanges())))
+		output_writer.Write(path, json({{"instancers", i->second}}).dump(1, '\t'));
+	scene_instance_arrays.erase(i);
+}
 
-						// u, v
-						for (int i = 0; i < uvs.size(); ++i)
-							uv[i].push_back(geo.uv[i][face_offset + f]);
-					}
+// Fingerprint of a prim recorded by the incremental import, computed once per import: the layers holding an opinion on the prim and a hash
+// of its composed content. Only accessed by the scene traversal.
+struct PrimFingerprint {
+	std::vector<std::string> layers;
+	std::optional<uint64_t> content;
+};
 
-					break;
-				}
+static std::map<pxr::SdfPath, PrimFingerprint> prim_fingerprints;
+
+template <class T> static bool HashArrayValue(const pxr::VtValue &value, uint64_t &h) {
+	if (!value.IsHolding<pxr::VtArray<T>>())
+		return false;
+	const auto &array = value.UncheckedGet<pxr::VtArray<T>>();
+	h = HashBytes(array.cdata(), array.size() * sizeof(T), h);
+	return true;
+}
+
+// Hash an attribute value, the large arrays of plain values by their bytes and the other values by their text.
+static uint64_t HashValue(const pxr::VtValue &value, uint64_t h) {
+	if (HashArrayValue<pxr::GfVec3f>(value, h) || HashArrayValue<pxr::GfVec2f>(value, h) || HashArrayValue<int>(value, h) ||
+		HashArrayValue<float>(value, h))
+		return h;
 
-			face_offset += geo.pol[i].vtx_count;
+	const auto text = pxr::TfStringify(value);
+	return HashBytes(text.data(), text.size(), h);
+}
+
+// Hash of the composed content of a prim: its type, its instancing, the values and time samples of its attributes and the targets of its
+// relationships.
+static uint64_t HashPrimContent(const pxr::UsdPrim &prim) {
+	const auto hash_string = [](const std::string &s, uint64_t h) { return HashBytes(s.data(), s.size(), h); };
+
+	uint64_t h = hash_string(prim.GetTypeName().GetString() + (prim.IsInstanceable() ? " instanceable" : ""), 0x13198a2e03707344ull);
+
+	for (const auto &attr : prim.GetAuthoredAttributes()) {
+		h = hash_string(attr.GetName().GetString(), h);
+
+		pxr::VtValue value;
+		if (attr.Get(&value))
+			h = HashValue(value, h);
+
+		std::vector<double> times;
+		attr.GetTimeSamples(&times);
+		for (const auto t : times) {
+			h = HashBytes(&t, sizeof(t), h);
+			if (attr.Get(&value, t))
+				h = HashValue(value, h);
 		}
-		geo.pol = pol;
-		geo.binding = binding;
-		geo.normal = normal;
-		geo.uv = uv;
 	}
-}
 
-static hg::Object GetObjectWithMaterial(const pxr::UsdPrim &p, std::set<pxr::TfToken> &uvMapVarname, hg::Scene &scene,
-	const Config &config, hg::PipelineResources &resources) {
+	for (const auto &rel : prim.GetAuthoredRelationships()) {
+		h = hash_string(rel.GetName().GetString(), h);
 
-	pxr::UsdGeomMesh geoUSD(p);
+		pxr::SdfPathVector targets;
+		rel.GetTargets(&targets);
+		for (const auto &target : targets)
+			h = hash_string(target.GetString(), h);
+	}
+	return h;
+}
 
-	std::string path = p.GetPath().GetString();
-	auto object = scene.CreateObject();
+static PrimFingerprint &GetPrimFingerprint(const pxr::UsdPrim &prim) {
+	auto i = prim_fingerprints.find(prim.GetPath());
+	if (i == prim_fingerprints.end()) {
+		std::set<std::string> layers;
+		AddContributingLayers(prim, layers);
+		i = prim_fingerprints.emplace(prim.GetPath(), PrimFingerprint{{layers.begin(), layers.end()}, {}}).first;
+	}
+	return i->second;
+}
 
-	// Add material to the primitive.
-	// MATERIALS:
-	// Assign one material per primitive.
-	bool foundMat = false;
-	pxr::UsdShadeMaterialBindingAPI materialBinding(p);
-	auto binding = materialBinding.GetDirectBinding();
-	if (pxr::UsdShadeMaterial shadeMaterial = binding.GetMaterial()) {
-		pxr::UsdShadeShader shader = shadeMaterial.ComputeSurfaceSource();
-
-		// if there is no shader with defaut render context, find the ONE
-		if (!shader) {
-			// find the output surface with the UsdPreviewSurface (we handle this one for now)
-			auto outputs = shadeMaterial.GetSurfaceOutputs();
-			for (const auto &output : outputs) {
-				if (output.HasConnectedSource()) {
-					// get the source connected to the output
-					auto sourceOutput = output.GetConnectedSources()[0].source;
-					auto sourceShaderName = sourceOutput.GetPrim().GetName().GetString();
-					if (sourceShaderName == "UsdPreviewSurface")
-						shader = pxr::UsdShadeShader(sourceOutput.GetPrim());
-				}
-			}
+static void AddMaterialPrims(const pxr::UsdPrim &prim, std::vector<pxr::UsdPrim> &prims) {
+	if (const auto material = pxr::UsdShadeMaterialBindingAPI(prim).GetDirectBinding().GetMaterial())
+		for (const auto &material_prim : pxr::UsdPrimRange(material.GetPrim()))
+			prims.push_back(material_prim);
+}
+
+// Prims the node of a prim is exported from: the prim, its mesh for a subset, its subsets for a mesh, its material and, for an instance or a
+// point instancer, the prims of its prototypes with their materials.
+static std::vector<pxr::UsdPrim> GetNodeSourcePrims(const pxr::UsdPrim &p) {
+	const auto type = p.GetTypeName();
+
+	std::vector<pxr::UsdPrim> prims = {p};
+	if (type == "GeomSubset")
+		prims.push_back(p.GetParent());
+	if (type == "Mesh")
+		for (const auto &child : p.GetChildren())
+			if (child.GetTypeName() == "GeomSubset")
+				prims.push_back(child);
+	AddMaterialPrims(p, prims);
+
+	const auto add_prototype = [&prims](const pxr::UsdPrim &root) {
+		for (const auto &prim : pxr::UsdPrimRange(root)) {
+			prims.push_back(prim);
+			AddMaterialPrims(prim, prims);
 		}
+	};
 
-		if (shader) {
-			foundMat = true;
+	if (p.IsInstance())
+		add_prototype(p.GetPrototype());
 
-			// get the material
-			auto mat = ExportMaterial(shader, uvMapVarname, *p.GetStage(), config, resources);
-			/*
-			if (geo.skin.size())
-				mat.flags |= hg::MF_EnableSkinning;
-			*/
-
-			// check double side
-			bool isDoubleSided = false;
-			geoUSD.GetDoubleSidedAttr().Get(&isDoubleSided);
-			// if it's a geo subset check the parent 
-			if (p.GetTypeName() == "GeomSubset")
-				pxr::UsdGeomMesh(p.GetParent()).GetDoubleSidedAttr().Get(&isDoubleSided);
+	if (type == "PointInstancer") {
+		pxr::SdfPathVector protoPaths;
+		pxr::UsdGeomPointInstancer(p).GetPrototypesRel().GetTargets(&protoPaths);
+		for (const auto &protoPath : protoPaths)
+			if (const auto proto = p.GetStage()->GetPrimAtPath(protoPath))
+				add_prototype(proto);
+	}
+	return prims;
+}
 
-			if (isDoubleSided)
-				SetMaterialFaceCulling(mat, hg::FC_Disabled);
+// Record a prim exported to the scene of the incremental import, returns true if its node is the same as in the previous run. The content of
+// the prims a node is exported from is only hashed when their layers changed, an opinion in a changed layer does not change the node if the
+// composed values are the same, as for the overs holding the changed children of a prim.
+static bool UpdateScenePrimManifest(const pxr::UsdPrim &p) {
+	const auto key = p.GetPath().GetString();
+	const auto prims = GetNodeSourcePrims(p);
+
+	std::set<std::string> layers;
+	for (const auto &prim : prims) {
+		const auto &fingerprint = GetPrimFingerprint(prim);
+		layers.insert(fingerprint.layers.begin(), fingerprint.layers.end());
+	}
 
-			object.SetMaterial(0, std::move(mat));
-			object.SetMaterialName(0, shader.GetPath().GetString());
-		}else
-			hg::error("!Unexpected shader from UsdShadeShader()");
+	json entry = {{"layers", std::vector<std::string>(layers.begin(), layers.end())}};
+
+	const json *previous = nullptr;
+	if (incremental.previous.is_object() && incremental.previous.contains("prims")) {
+		const auto i = incremental.previous["prims"].find(key);
+		if (i != incremental.previous["prims"].end() && i->contains("content"))
+			previous = &*i;
 	}
-	
-	// If the material is not found, create a dummy material to make the object visible in the engine.
-	if(!foundMat) {
-		hg::debug(hg::format("	- Has no material, set a dummy one"));
 
-		hg::Material mat;
-		std::string shader;
+	if (previous && (*previous)["layers"] == entry["layers"] && AreLayersUnchanged(entry["layers"])) {
+		entry["content"] = (*previous)["content"];
+		incremental.prims[key] = entry;
+		return true;
+	}
 
-		shader = "core/shader/pbr.hps";
+	uint64_t h = 0xa4093822299f31d0ull;
+	for (const auto &prim : prims) {
+		auto &fingerprint = GetPrimFingerprint(prim);
+		if (!fingerprint.content)
+			fingerprint.content = HashPrimContent(prim);
+		h = HashBytes(&*fingerprint.content, sizeof(uint64_t), h);
+	}
 
-		if (!config.shader.empty())
-			shader = config.shader; // Use the overridden shader if it is provided in the configuration.
+	char content[17];
+	snprintf(content, sizeof(content), "%016llx", static_cast<unsigned long long>(h));
+	entry["content"] = content;
+	incremental.prims[key] = entry;
+	return previous && (*previous)["content"] == entry["content"];
+}
 
-		hg::debug(hg::format("	- Using pipeline shader '%1'").arg(shader));
-		mat.program = resources.programs.Add(shader.c_str(), {});
+// Composition arcs of an instance, instances sharing them share a prototype. Unlike the prototype names they do not depend on the payloads
+// loaded so far.
+static std::string GetInstancingKey(const pxr::UsdPrim &p) {
+	std::string key;
+	for (auto o : p.GetPrimIndex().GetNodeRange())
+		if (!o.IsRootNode())
+			key += o.GetLayerStack()->GetIdentifier().rootLayer->GetIdentifier() + "<" + o.GetPath().GetString() + ">";
+	return key;
+}
 
-		// check in case there is special primvars
-		hg::Vec4 diffuse = {0.5f, 0.5f, 0.5f, 1.f};
-		if (auto diffuseAttr = p.GetAttribute(pxr::TfToken("primvars:displayColor"))) {
-			//auto y = diffuseAttr.GetTypeName().GetCPPTypeName();
-			pxr::VtArray<pxr::GfVec3f> diffuseUSD;
-			diffuseAttr.Get(&diffuseUSD);
-			if (diffuseUSD.size() > 1) {
-				diffuse.x = diffuseUSD[0].data()[0];
-				diffuse.y = diffuseUSD[0].data()[1];
-				diffuse.z = diffuseUSD[0].data()[2];
-			}
-		}
+static void ExportPrims(const pxr::UsdPrim &root, hg::Node *nodeRoot, hg::Scene &scene, const Config &config, hg::PipelineResources &resources);
+static void ExportPrimTree(pxr::UsdPrim p, hg::Node *nodeParent, hg::Scene &scene, const Config &config, hg::PipelineResources &resources);
 
-		mat.values["uBaseOpacityColor"] = {bgfx::UniformType::Vec4, {diffuse.x, diffuse.y, diffuse.z, diffuse.w}};
-		mat.values["uOcclusionRoughnessMetalnessColor"] = {bgfx::UniformType::Vec4, {1.f, 1.f, 0.f, -1.f}};
-		mat.values["uSelfColor"] = {bgfx::UniformType::Vec4, {0.f, 0.f, 0.f, -1.f}};
+// Save a prototype to its own scene the first time it is instanced, returns the resource name of the scene. export_prototype exports the
+// prototype under the root node of the scene.
+static std::string GetPrototypeScene(const std::string &key, const std::string &name, const std::function<void(hg::Scene &, hg::Node &)> &export_prototype,
+	const Config &config, hg::PipelineResources &resources) {
+	std::string out_path_proto;
+	if (protoToInstance.Find(key, out_path_proto))
+		return out_path_proto;
+
+	hg::Scene sceneProto;
+	auto nodeProto = sceneProto.CreateNode(name);
+	nodeProto.SetTransform(sceneProto.CreateTransform());
+
+	export_prototype(sceneProto, nodeProto);
+	BindSkinnedObjects(sceneProto);
+	AddTransformAnimations(sceneProto, name, config);
+	SaveInstanceArrayList(sceneProto, name, config);
+
+	const bool save = GetOutputPath(out_path_proto, config.base_output_path, name, {}, GetSceneExtension(config),
+		GetIncrementalPolicy(config.import_policy_scene, !incremental.HasChanges()));
+	if (save)
+		// saved on this thread, the scene refers to the resources the traversal is still adding to
+		output_writer.Save(out_path_proto, [&](const std::string &path) { return SaveScene(path, sceneProto, resources, config); });
+
+	const auto out_path_scene = out_path_proto;
+	out_path_proto = MakeRelativeResourceName(out_path_proto, config.prj_path, config.prefix);
+
+	if (config.scene_bvh)
+		FinishSceneBounds(sceneProto, out_path_proto, save ? out_path_scene : std::string());
+	protoToInstance.Set(key, out_path_proto);
+	return out_path_proto;
+}
 
-		object.SetMaterial(0, std::move(mat));
-		object.SetMaterialName(0, "dummy_mat");
+// Convert the instance transforms of a point instancer in a single pass, translations are converted to meters as in GetXFormMat.
+static void ConvertInstanceTransforms(const pxr::VtArray<pxr::GfMatrix4d> &xforms, float meters_per_unit, std::vector<hg::Mat4> &mats) {
+	const size_t count = xforms.size();
+	mats.resize(count);
+
+	const pxr::GfMatrix4d *src = xforms.cdata();
+	hg::Mat4 *dst = mats.data();
+
+	for (size_t i = 0; i < count; ++i) {
+		const double *t = src[i].data();
+		dst[i] = hg::Mat4(float(t[0]), float(t[1]), float(t[2]), float(t[4]), float(t[5]), float(t[6]), float(t[8]), float(t[9]), float(t[10]),
+			float(t[12] * meters_per_unit), float(t[13] * meters_per_unit), float(t[14] * meters_per_unit));
 	}
+}
 
-	return object;
+// Instance transforms of a point instancer, saved by -instancer-arrays. All values are little-endian:
+//	char magic[4] = "HGPI", uint32 version = 1, uint32 prototype count
+//	per prototype: uint32 scene name size, char scene name[size], uint32 instance count, float transforms[count][3][4] (hg::Mat4 rows)
+static std::string PackInstanceArrays(const std::vector<std::string> &protoScenes, const std::vector<std::vector<hg::Mat4>> &instances) {
+	std::string data("HGPI", 4);
+	const auto write_u32 = [&data](uint32_t v) { data.append(reinterpret_cast<const char *>(&v), sizeof(v)); };
+
+	write_u32(1);
+	write_u32(uint32_t(protoScenes.size()));
+
+	for (size_t i = 0; i < protoScenes.size(); ++i) {
+		write_u32(uint32_t(protoScenes[i].size()));
+		data += protoScenes[i];
+		write_u32(uint32_t(instances[i].size()));
+		for (const auto &m : instances[i])
+			data.append(reinterpret_cast<const char *>(m.m), sizeof(m.m));
+	}
+	return data;
 }
-std::map<std::string, hg::Object> primToObject;
-std::map<std::string, std::string> protoToInstance;
-//
-static hg::Object ExportObject(const pxr::UsdPrim &p, hg::Node *node, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
-	hg::Object object;
 
-	pxr::UsdGeomMesh geoUSD(p);
-	std::string path = p.GetPath().GetString();
+// Export the instances of a point instancer. Each prototype is saved once to its own scene, the instances either become nodes instancing
+// it or are saved as transform arrays listed next to the scene.
+static void ExportPointInstancer(const pxr::UsdPrim &p, hg::Node &node, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+	TraceScope trace_scope("ExportPointInstancer", p.GetPath());
+	pxr::UsdGeomPointInstancer instancer(p);
+	const auto stage = p.GetStage();
+
+	pxr::SdfPathVector protoPaths;
+	instancer.GetPrototypesRel().GetTargets(&protoPaths);
+
+	std::vector<std::string> protoScenes;
+	for (const auto &protoPath : protoPaths) {
+		const auto proto = stage->GetPrimAtPath(protoPath);
+		if (!proto) {
+			hg::warn(hg::format("Point instancer '%1' prototype '%2' not found").arg(p.GetPath().GetString()).arg(protoPath.GetString()));
+			protoScenes.emplace_back();
+			continue;
+		}
 
-	std::string hashIdentifierPrim;
-	for (auto o : p.GetPrimIndex().GetNodeRange())	
-		hashIdentifierPrim = pxr::TfStringify(o.GetLayerStack()) + o.GetPath().GetText();
+		// the prototype transform is part of its scene, the instance transforms exclude it
+		protoScenes.push_back(GetPrototypeScene(
+			protoPath.GetString(), protoPath.GetString(),
+			[&](hg::Scene &sceneProto, hg::Node &nodeProto) { ExportPrimTree(proto, &nodeProto, sceneProto, config, resources); }, config,
+			resources));
+	}
 
-	//auto j = p.GetPrimIndex().DumpToString();
-	//auto d = p.GetPrimIndex().GetNodeRange().DumpToString();
-	/*auto m = pxr::TfStringify(p.GetPrimIndex().GetRootNode().GetLayerStack());
-	auto j=p.GetPrimIndex().GetRootNode().GetLayerStack()->GetLayers();
-	auto k = p.GetPrimIndex().GetRootNode().GetLayerStack()->GetLayers()[0]->GetDisplayName();
-*/
-	// If the geometry is not found, import it.
-	if (primToObject.find(hashIdentifierPrim) != primToObject.end()) {
-		object = primToObject[hashIdentifierPrim];
-	} else {
-		// If the geometry is not found, import it.
-		hg::Geometry geo;
+	const auto time = pxr::UsdTimeCode::EarliestTime();
 
-		std::set<pxr::TfToken> uvMapVarname;
+	pxr::VtIntArray protoIndices;
+	instancer.GetProtoIndicesAttr().Get(&protoIndices, time);
 
-		object = GetObjectWithMaterial(p, uvMapVarname, scene, config, resources);
+	pxr::VtArray<pxr::GfMatrix4d> xforms;
+	if (!instancer.ComputeInstanceTransformsAtTime(
+			&xforms, time, time, pxr::UsdGeomPointInstancer::ExcludeProtoXform, pxr::UsdGeomPointInstancer::IgnoreMask) ||
+		xforms.size() != protoIndices.size()) {
+		hg::error(hg::format("Failed to compute the instance transforms of point instancer '%1'").arg(p.GetPath().GetString()));
+		return;
+	}
 
-		ExportGeometry(geoUSD, nullptr, geo, uvMapVarname);
+	const auto mask = instancer.ComputeMaskAtTime(time); // empty if all instances are visible
 
-		const auto vtx_to_pol = hg::ComputeVertexToPolygon(geo);
-		auto vtx_normal = hg::ComputeVertexNormal(geo, vtx_to_pol, hg::Deg(45.f));
+	std::vector<hg::Mat4> mats;
+	ConvertInstanceTransforms(xforms, float(pxr::UsdGeomGetStageMetersPerUnit(stage)), mats);
 
-		// Recalculate the vertex normals.
-		bool recalculate_normal = config.recalculate_normal;
-		if (geo.normal.empty())
-			recalculate_normal = true;
+	std::vector<std::vector<hg::Mat4>> instances(protoScenes.size());
+	for (size_t i = 0; i < mats.size(); ++i) {
+		const int index = protoIndices[i];
+		if ((!mask.empty() && !mask[i]) || index < 0 || size_t(index) >= protoScenes.size() || protoScenes[index].empty())
+			continue;
+		instances[index].push_back(mats[i]);
+	}
 
-		if (recalculate_normal) {
-			hg::debug("    - Recalculate normals");
-			geo.normal = vtx_normal;
-		} else
-			vtx_normal = geo.normal;
+	hg::debug(hg::format("	%1 instances of %2 prototypes").arg(mats.size()).arg(protoScenes.size()));
 
-		// Recalculate the vertex tangent frame.
-		bool recalculate_tangent = config.recalculate_tangent;
-		if (geo.tangent.empty())
-			recalculate_tangent = true;
-		else if (geo.tangent.size() != geo.normal.size()) { // be sure tangent is same size of normal, some strange things can happen with multiple
-			hg::debug("CAREFUL Normal and Tangent are not the same size, can happen if you have submesh (some with tangent and some without)");
-			geo.tangent.resize(geo.normal.size());
-		}
+	if (config.instancer_arrays) {
+		std::string path = p.GetPath().GetString();
+		if (GetOutputPath(path, config.base_output_path, path, {}, "instances", GetIncrementalPolicy(config.import_policy_scene, !incremental.HasChanges())))
+			output_writer.Write(path, PackInstanceArrays(protoScenes, instances));
 
-		if (recalculate_tangent) {
-			hg::debug("    - Recalculate tangent frames (MikkT)");
-			if (!geo.uv[0].empty())
-				geo.tangent = hg::ComputeVertexTangent(geo, vtx_normal, 0, hg::Deg(45.f));
+		const auto instances_name = MakeRelativeResourceName(path, config.prj_path, config.prefix);
+		scene_instance_arrays[&scene].push_back({{"node", p.GetPath().GetString()}, {"instances", instances_name}});
+		return;
+	}
+
+	const auto name = p.GetName().GetString() + "_";
+	for (size_t i = 0, n = 0; i < protoScenes.size(); ++i)
+		for (const auto &m : instances[i]) {
+			auto instance = scene.CreateNode(name + std::to_string(n++));
+			instance.SetTransform(scene.CreateTransform());
+			instance.GetTransform().SetParent(node.ref);
+			instance.GetTransform().SetLocal(m);
+			instance.SetInstance(scene.CreateInstance(protoScenes[i]));
+			if (config.scene_bvh)
+				RecordNodeBounds(scene, instance, &node, m, nullptr, protoScenes[i]);
 		}
+}
+
+// Find the skinned meshes below a SkelRoot and their skeleton, before they are exported.
+static void BindSkelRoot(const pxr::UsdPrim &p) {
+	TraceScope trace_scope("BindSkelRoot", p.GetPath());
+
+	const pxr::UsdSkelRoot root(p);
+	std::vector<pxr::UsdSkelBinding> bindings;
+	if (!skel_cache.Populate(root, pxr::UsdPrimDefaultPredicate) || !skel_cache.ComputeSkelBindings(root, &bindings, pxr::UsdPrimDefaultPredicate)) {
+		hg::warn(hg::format("Failed to read the skinning of '%1'").arg(p.GetPath().GetString()));
+		return;
+	}
 
-		if (GetOutputPath(path, config.base_output_path, path, {}, "geo", config.import_policy_geometry)) {
-			hg::debug(hg::format("Export geometry to '%1'").arg(path));
-			hg::SaveGeometryToFile(path.c_str(), geo);
+	const float meters_per_unit = float(pxr::UsdGeomGetStageMetersPerUnit(p.GetStage()));
+
+	for (const auto &binding : bindings) {
+		const auto query = skel_cache.GetSkelQuery(binding.GetSkeleton());
+		if (!query)
+			continue;
+
+		const auto joint_order = query.GetJointOrder();
+		pxr::VtMatrix4dArray bind_xforms;
+		if (!query.GetJointWorldBindTransforms(&bind_xforms) || bind_xforms.size() != joint_order.size()) {
+			hg::warn(hg::format("Skeleton '%1' has no bind transform for each joint").arg(binding.GetSkeleton().GetPath().GetString()));
+			continue;
 		}
 
-		path = MakeRelativeResourceName(path, config.prj_path, config.prefix);
+		std::map<pxr::TfToken, int> joint_index;
+		for (size_t j = 0; j < joint_order.size(); ++j)
+			joint_index[joint_order[j]] = int(j);
 
-		object.SetModelRef(resources.models.Add(path.c_str(), {}));
+		for (const auto &skinning : binding.GetSkinningTargets()) {
+			if (!skinning.HasJointInfluences())
+				continue;
 
-		primToObject[hashIdentifierPrim] = object;
-	}	
+			SkinBinding skin;
+			skin.skinning = skinning;
+			skin.skeleton = binding.GetSkeleton().GetPath();
 
-		// find bind pose in the skins
-	/*	if (gltf_node.skin >= 0) {
-			hg::debug(hg::format("Exporting geometry skin"));
-
-			const auto &skin = model.skins[gltf_node.skin];
-			geo.bind_pose.resize(skin.joints.size());
-
-			const auto attribAccessor = model.accessors[skin.inverseBindMatrices];
-			const auto &bufferView = model.bufferViews[attribAccessor.bufferView];
-			const auto &buffer = model.buffers[bufferView.buffer];
-			const auto dataPtr = buffer.data.data() + bufferView.byteOffset + attribAccessor.byteOffset;
-			const auto byte_stride = attribAccessor.ByteStride(bufferView);
-			const auto count = attribAccessor.count;
-
-			switch (attribAccessor.type) {
-				case TINYGLTF_TYPE_MAT4: {
-					switch (attribAccessor.componentType) {
-						case TINYGLTF_COMPONENT_TYPE_DOUBLE:
-						case TINYGLTF_COMPONENT_TYPE_FLOAT: {
-							floatArray<float> value(arrayAdapter<float>(dataPtr, count * 16, sizeof(float)));
-
-							for (size_t k{0}; k < count; ++k) {
-								hg::Mat4 m_InverseBindMatrices(value[k * 16], value[k * 16 + 1], value[k * 16 + 2], value[k * 16 + 4], value[k * 16 + 5],
-									value[k * 16 + 6], value[k * 16 + 8], value[k * 16 + 9], value[k * 16 + 10], value[k * 16 + 12], value[k * 16 + 13],
-									value[k * 16 + 14]);
-
-								m_InverseBindMatrices = hg::InverseFast(m_InverseBindMatrices);
-
-								auto p = hg::GetT(m_InverseBindMatrices);
-								p.z = -p.z;
-								auto r = hg::GetR(m_InverseBindMatrices);
-								r.x = -r.x;
-								r.y = -r.y;
-								auto s = hg::GetS(m_InverseBindMatrices);
-
-								geo.bind_pose[k] = hg::InverseFast(hg::TransformationMat4(p, r, s));
-							}
-						} break;
-						default:
-							hg::error("Unhandeled component type for inverseBindMatrices");
-					}
-				} break;
-				default:
-					hg::error("Unhandeled MAT4 type for inverseBindMatrices");
+			pxr::VtTokenArray skinning_order; // a mesh may use its own subset or order of the skeleton joints
+			if (skinning.GetJointOrder(&skinning_order)) {
+				for (const auto &joint : skinning_order) {
+					const auto i = joint_index.find(joint);
+					skin.joint_remap.push_back(i != joint_index.end() ? i->second : -1);
+				}
+			} else {
+				skin.joint_remap.resize(joint_order.size());
+				std::iota(skin.joint_remap.begin(), skin.joint_remap.end(), 0);
 			}
-		}*/
 
-	return object;
+			// geometry bind transform followed by the inverse of the joint bind transform, USD matrices transform row vectors. The renderer
+			// skins a vertex by the joint world matrix times the bind pose, which gives back the geometry bind transform at rest.
+			const auto geom_bind = skinning.GetGeomBindTransform();
+			pxr::VtMatrix4dArray bind_pose;
+			bind_pose.resize(bind_xforms.size());
+			for (size_t j = 0; j < bind_xforms.size(); ++j)
+				bind_pose[j] = geom_bind * bind_xforms[j].GetInverse();
+			ConvertInstanceTransforms(bind_pose, meters_per_unit, skin.bind_pose);
 
+			skin_bindings.Set(skinning.GetPrim().GetPath(), std::make_shared<const SkinBinding>(std::move(skin)));
+		}
+	}
 }
 
-static void ExportCamera(const pxr::UsdPrim &p, hg::Node *nodeParent, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
-	auto camera = scene.CreateCamera();
-	nodeParent->SetCamera(camera);
-
-	auto cameraUSD = pxr::UsdGeomCamera(p);
-
-	pxr::GfVec2f clippingRange;
-	cameraUSD.GetClippingRangeAttr().Get(&clippingRange);
-	camera.SetZNear(clippingRange[0]);
-	camera.SetZFar(clippingRange[1]);
+// Queue the sampling of the joint animation of a skeleton, all the joints are computed at once for each time sample.
+static void QueueSkeletonAnimation(
+	const pxr::UsdPrim &p, const pxr::UsdSkelSkeletonQuery &query, const std::vector<hg::NodeRef> &joints, const hg::Scene &scene, const Config &config) {
+	std::vector<double> times;
+	const auto &anim_query = query.GetAnimQuery();
+	if (!anim_query || !anim_query.GetJointTransformTimeSamples(&times) || times.size() < 2)
+		return;
 
-	pxr::TfToken projAttr;
-	cameraUSD.GetProjectionAttr().Get(&projAttr);
-	if (projAttr == pxr::UsdGeomTokens->orthographic) {
-		camera.SetIsOrthographic(true);
-	}else {
-		float fov;
-		cameraUSD.GetVerticalApertureAttr().Get(&fov);
-		camera.SetFov(hg::Deg(fov));
-		camera.SetIsOrthographic(false);
-	}	
-}
+	const auto joint_order = query.GetJointOrder();
 
-static void ExportLight(const pxr::UsdPrim &p, const pxr::TfToken type, hg::Node *nodeParent, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
-	auto light = scene.CreateLight();
-	nodeParent->SetLight(light);
-	pxr::UsdLuxBoundableLightBase lightUSD;
-	if (type == "SphereLight") {
-		pxr::UsdLuxSphereLight sphereLight(p);
-		lightUSD = (pxr::UsdLuxBoundableLightBase)sphereLight;
-		light.SetType(hg::LT_Point);
+	auto &animations = transform_animations[&scene];
+	std::vector<hg::Anim *> anims;
+	for (size_t j = 0; j < joints.size(); ++j) {
+		animations.nodes.push_back({p.GetPath().GetString() + "/" + joint_order[j].GetString(), joints[j], {}});
+		anims.push_back(&animations.nodes.back().anim);
+	}
 
-		float radiusAttr;
-		sphereLight.GetRadiusAttr().Get(&radiusAttr);
-		light.SetRadius(radiusAttr);
+	geometry_pool.Queue([p, query, times = std::move(times), anims = std::move(anims), &config]() {
+		TraceScope trace_scope("SampleSkeletonAnimation", p.GetPath());
 
-	} else if (type == "DistantLight") {
-		pxr::UsdLuxDistantLight distantLight(p);
-		lightUSD = (pxr::UsdLuxBoundableLightBase)distantLight;
-		light.SetType(hg::LT_Spot);
+		const float meters_per_unit = float(pxr::UsdGeomGetStageMetersPerUnit(p.GetStage()));
 
-		float angleAttr;
-		distantLight.GetAngleAttr().Get(&angleAttr);
-		light.SetRadius(angleAttr);
+		std::vector<std::vector<hg::Mat4>> joint_mats(anims.size(), std::vector<hg::Mat4>(times.size(), hg::Mat4::Identity));
+		pxr::VtMatrix4dArray xforms;
+		std::vector<hg::Mat4> mats;
+		for (size_t i = 0; i < times.size(); ++i)
+			if (query.ComputeJointLocalTransforms(&xforms, times[i])) {
+				ConvertInstanceTransforms(xforms, meters_per_unit, mats);
+				for (size_t j = 0; j < anims.size() && j < mats.size(); ++j)
+					joint_mats[j][i] = mats[j];
+			}
 
-	} else if (type == "DomeLight") {
-		pxr::UsdLuxDomeLight domeLight(p);
-		lightUSD = (pxr::UsdLuxBoundableLightBase)domeLight;
-	}	
-	
-	// add common value
-	if (type == "SphereLight" || type == "DistantLight" || type == "DomeLight") {
-		pxr::GfVec3f colorAttr;
-		lightUSD.GetColorAttr().Get(&colorAttr);
-		light.SetDiffuseColor(hg::Color(colorAttr.data()[0], colorAttr.data()[1], colorAttr.data()[2]));
-	}		
+		const double time_codes_per_second = p.GetStage()->GetTimeCodesPerSecond();
+		for (size_t j = 0; j < anims.size(); ++j)
+			ReduceTransformSamples(times, time_codes_per_second, joint_mats[j], config, *anims[j]);
+	}, animations.sampling);
 }
 
-static hg::Mat4 GetXFormMat(const pxr::UsdPrim& p) {
-	auto xForm = pxr::UsdGeomXformable(p);
-	pxr::GfMatrix4d transform;
-	bool resetsXformStack;
-	xForm.GetLocalTransformation(&transform, &resetsXformStack);
+// Create a node per joint of a skeleton below the skeleton node, placed at the joint transform at the default time.
+static void ExportSkeleton(const pxr::UsdPrim &p, hg::Node &node, hg::Scene &scene, const Config &config) {
+	const auto query = skel_cache.GetSkelQuery(pxr::UsdSkelSkeleton(p));
+	if (!query) {
+		hg::warn(hg::format("Invalid skeleton '%1'").arg(p.GetPath().GetString()));
+		return;
+	}
 
-	hg::Mat4 m(transform.data()[0], transform.data()[1], transform.data()[2], transform.data()[4], transform.data()[5], transform.data()[6], transform.data()[8],
-		transform.data()[9], transform.data()[10], transform.data()[12], transform.data()[13], transform.data()[14]);
+	const auto joint_order = query.GetJointOrder();
+	const auto &topology = query.GetTopology();
+
+	pxr::VtMatrix4dArray xforms;
+	std::vector<hg::Mat4> mats;
+	if (query.ComputeJointLocalTransforms(&xforms, pxr::UsdTimeCode::Default()))
+		ConvertInstanceTransforms(xforms, float(pxr::UsdGeomGetStageMetersPerUnit(p.GetStage())), mats);
+	mats.resize(joint_order.size(), hg::Mat4::Identity);
+
+	auto &joints = scene_skeletons[&scene].joints[p.GetPath()];
+	joints.resize(joint_order.size());
+	for (size_t j = 0; j < joint_order.size(); ++j) {
+		auto joint = scene.CreateNode(pxr::SdfPath(joint_order[j].GetString()).GetName());
+		joint.SetTransform(scene.CreateTransform());
+
+		const int parent = topology.GetParent(j); // parents come first in the joint order
+		joint.GetTransform().SetParent(parent >= 0 && size_t(parent) < j ? joints[parent] : node.ref);
+		joint.GetTransform().SetLocal(mats[j]);
+		joints[j] = joint.ref;
+	}
 
-	auto t = hg::GetT(m) * pxr::UsdGeomGetStageMetersPerUnit(p.GetStage());
-	hg::SetT(m, t);
+	hg::debug(hg::format("	Skeleton '%1': %2 joints").arg(p.GetPath().GetString()).arg(joints.size()));
 
-	return m;
+	if (config.import_animation)
+		QueueSkeletonAnimation(p, query, joints, scene, config);
 }
 
-//
-static void ExportNode(const pxr::UsdPrim &p, hg::Node *nodeParent, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+// Export a prim to a scene node, returns an invalid node for the prims not exported to the scene.
+static hg::Node ExportNode(const pxr::UsdPrim &p, hg::Node *nodeParent, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
 
 	auto type = p.GetTypeName();
 
 	if (type == "Material" || type == "Shader") // don't export node to scene for these types
-		return;
+		return {};
 
+	TraceScope trace_scope("ExportNode", p.GetPath());
 	hg::log(hg::format("type: %1, %2").arg(type.GetString()).arg(p.GetPath().GetString().c_str()));
+
+	if (incremental.enabled && &scene == incremental.scene)
+		UpdateScenePrimManifest(p);
 	pxr::ArResolverContextBinder resolverContextBinder(p.GetStage()->GetPathResolverContext());
 
 	auto node = scene.CreateNode(p.GetName());
 	node.SetTransform(scene.CreateTransform());
 
-	// Transform
-	hg::Mat4 m = GetXFormMat(p);
-
-	// If there is no parent, modify the base matrix.
-	if (!nodeParent) {
-		// Rotate the transform to account for the Z-axis as the up direction.
-		if (UsdGeomGetStageUpAxis(p.GetStage()) == pxr::UsdGeomTokens->z) {
-			hg::Mat44 to_hg(1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 1.f);
-
-			auto xForm = pxr::UsdGeomXformable(p);
-			pxr::GfMatrix4d transform;
-			bool resetsXformStack;
-			xForm.GetLocalTransformation(&transform, &resetsXformStack);
-
-			hg::Mat44 m44(transform.data()[0], transform.data()[1], transform.data()[2], transform.data()[3], transform.data()[4], transform.data()[5],
-				transform.data()[6], transform.data()[7], transform.data()[8], transform.data()[9], transform.data()[10], transform.data()[11],
-				transform.data()[12], transform.data()[13], transform.data()[14], transform.data()[15]);
-
-			m44 = to_hg * m44;
-
-			hg::Mat4 mt(m44.m[0][0], m44.m[1][0], m44.m[2][0], m44.m[0][1], m44.m[1][1], m44.m[2][1], m44.m[0][2], m44.m[1][2], m44.m[2][2], m44.m[0][3],
-				m44.m[1][3], m44.m[2][3]);
-			m = mt;
-		}
-		auto s = hg::GetS(m) * config.geometry_scale;
-		hg::SetS(m, s);
-	} else {
-		// there is a node parent, so parent it
+	// there is a node parent, so parent it
+	if (nodeParent)
 		node.GetTransform().SetParent(nodeParent->ref);
-	}
+
+	// transform of the node content, applied after the prim transform
+	hg::Mat4 post = hg::Mat4::Identity;
+	const GeometryBounds *bounds = nullptr;
+	std::string instance_scene;
 
 	// Camera
 	if (type == "Camera") {
-		m = m * hg::Mat4(hg::RotationMatX(hg::Pi)) * hg::Mat4(hg::RotationMatZ(hg::Pi));
-		auto s = hg::GetS(m);
-		hg::SetS(m, hg::Vec3(-s.x, s.y, s.z));
 		ExportCamera(p, &node, scene, config, resources);
 	}// light
 	else if (type == "DomeLight" || type == "DistantLight" || type == "SphereLight") {
 		ExportLight(p, type, &node, scene, config, resources);
 	}// Mesh 
 	else if (type == "Mesh") {
-		auto object = ExportObject(p, &node, scene, config, resources);
+		const auto exported = ExportObject(p, scene, config, resources);
 		// set object
-		node.SetObject(object);
+		node.SetObject(exported.object);
+		post = exported.offset;
+		bounds = exported.bounds;
 	}// GeomSubset
 	else if (type == "GeomSubset") {
-		hg::Object object;
-
-		std::string hashIdentifierPrim;
-		for (auto o : p.GetPrimIndex().GetNodeRange())
-			hashIdentifierPrim = pxr::TfStringify(o.GetLayerStack()) + o.GetPath().GetText();
-
-		// auto j = c.GetPrimIndex().DumpToString();
-		// If the geometry is not found, import it.
-		if (primToObject.find(hashIdentifierPrim) != primToObject.end()) {
-			object = primToObject[hashIdentifierPrim];
-		} else {
-			std::string path = p.GetPath().GetString();
-			hg::debug(hg::format("	add geometry subset").arg(path));
-			pxr::UsdGeomSubset subsetC(p);
-			std::set<pxr::TfToken> uvMapVarname;
-			object = GetObjectWithMaterial(p, uvMapVarname, scene, config, resources);
-
-			hg::Geometry geoSubset;
-			pxr::UsdGeomMesh geoUSDParent(p.GetParent());
-			ExportGeometry(geoUSDParent, &subsetC, geoSubset, uvMapVarname);
-
-			if (GetOutputPath(path, config.base_output_path, path, {}, "geo", config.import_policy_geometry)) {
-				hg::debug(hg::format("Export geometry to '%1'").arg(path));
-				hg::SaveGeometryToFile(path.c_str(), geoSubset);
-			}
-
-			path = MakeRelativeResourceName(path, config.prj_path, config.prefix);
-			object.SetModelRef(resources.models.Add(path.c_str(), {}));
-			primToObject[hashIdentifierPrim] = object;
-		}
-		node.SetObject(object);
+		hg::debug(hg::format("	add geometry subset %1").arg(p.GetPath().GetString()));
+		const auto exported = ExportObject(p, scene, config, resources);
+		node.SetObject(exported.object);
+		post = exported.offset;
+		bounds = exported.bounds;
 
 		// If it's a subset, make sure to remove the parent mesh object.
 		nodeParent->SetObject({});
+		if (config.scene_bvh)
+			ClearNodeObjectBounds(scene, *nodeParent);
 
 	} // Sphere
 	else if (type == "Sphere") {
@@ -923,7 +4755,7 @@ static void ExportNode(const pxr::UsdPrim &p, hg::Node *nodeParent, hg::Scene &s
 		pxr::UsdGeomSphere sphere(p);
 		float radiusAttr = 1.f;
 		sphere.GetRadiusAttr().Get(&radiusAttr);
-		m = m * hg::ScaleMat4(radiusAttr * pxr::UsdGeomGetStageMetersPerUnit(p.GetStage()));
+		post = hg::ScaleMat4(radiusAttr * pxr::UsdGeomGetStageMetersPerUnit(p.GetStage()));
 
 		/* auto sphere_model = hg::CreateSphereModel(vs_pos_normal_decl, radiusAttr, 5, 5);
 		auto sphere_model_ref = resources.models.Add(p.GetPath().GetString().c_str(), sphere_model);
@@ -932,45 +4764,349 @@ static void ExportNode(const pxr::UsdPrim &p, hg::Node *nodeParent, hg::Scene &s
 		object.SetModelRef(resources.models.Add("core_library/primitives/sphere.geo", {}));
 		node.SetObject(object);
 
+	} // SkelRoot, its skinned meshes are found before they are exported
+	else if (type == "SkelRoot") {
+		BindSkelRoot(p);
+	} // Skeleton
+	else if (type == "Skeleton") {
+		ExportSkeleton(p, node, scene, config);
+	} // PointInstancer
+	else if (type == "PointInstancer") {
+		ExportPointInstancer(p, node, scene, config, resources);
 	}
 	
 	// Check the children.
 	if (p.IsInstance()){
 		auto proto = p.GetPrototype();
-		auto protoName = proto.GetName().GetString();
-		std::string out_path_proto;
-		if (protoToInstance.find(protoName) != protoToInstance.end()) {
-			out_path_proto = protoToInstance[protoName];
-		} else {
-			hg::Scene sceneProto;
-			auto nodeProto = sceneProto.CreateNode(protoName);
-			nodeProto.SetTransform(sceneProto.CreateTransform());
 
-			for (auto c : p.GetPrototype().GetChildren())
-				ExportNode(c, &nodeProto, sceneProto, config, resources);
+		// prototypes are numbered again as payloads are loaded and unloaded, instances are matched on their composition arcs so that a prototype
+		// scene is named the same whether the payloads are streamed or not
+		const auto protoKey = GetInstancingKey(p);
+		const auto protoName = "prototype-" + hg::ComputeSHA1String(protoKey.data(), protoKey.size()).substr(0, 16);
+
+		const auto out_path_proto = GetPrototypeScene(
+			protoKey, protoName,
+			[&](hg::Scene &sceneProto, hg::Node &nodeProto) {
+				ExportPrims(proto, &nodeProto, sceneProto, config, resources);
+				nodeProto.GetTransform().SetParent(node.ref);
+			},
+			config, resources);
+
+		node.SetInstance(scene.CreateInstance(out_path_proto));
+		instance_scene = out_path_proto;
+	}
+
+	// Set the matrix
+	const auto local = GetNodeMatrix(p, !nodeParent, pxr::UsdTimeCode::Default(), post, config);
+	node.GetTransform().SetLocal(local);
+	if (config.scene_bvh)
+		RecordNodeBounds(scene, node, nodeParent, local, bounds, instance_scene);
+	if (config.import_animation)
+		QueueTransformAnimation(p, node, !nodeParent, post, scene, config);
+	return node;
+}
+
+static bool IsUnloadedPayload(const pxr::UsdPrim &p) { return p.HasAuthoredPayloads() && !p.IsLoaded(); }
+
+// Prims visited by the export, unlike the default predicate it does not skip the unloaded payloads so that they can be streamed.
+static const pxr::Usd_PrimFlagsPredicate export_predicate = pxr::UsdPrimIsActive && pxr::UsdPrimIsDefined && !pxr::UsdPrimIsAbstract;
+
+static bool IsExcluded(const pxr::SdfPath &path, const Config &config) {
+	for (const auto &exclude_path : config.exclude_paths)
+		if (path.HasPrefix(exclude_path))
+			return true;
+	return false;
+}
+
+// Point instancer prototypes authored outside of their instancer. They are only exported to their prototype scene, the traversal prunes them.
+static std::set<pxr::SdfPath> instancer_prototypes;
+
+static void FindInstancerPrototypes(const pxr::UsdPrim &root) {
+	TraceScope trace_scope("FindInstancerPrototypes", root.GetPath());
+
+	for (const auto &p : pxr::UsdPrimRange(root, export_predicate)) {
+		if (p.GetTypeName() != "PointInstancer")
+			continue;
+
+		pxr::SdfPathVector protoPaths;
+		pxr::UsdGeomPointInstancer(p).GetPrototypesRel().GetTargets(&protoPaths);
+		for (const auto &protoPath : protoPaths)
+			if (!protoPath.HasPrefix(p.GetPath()))
+				instancer_prototypes.insert(protoPath);
+	}
+}
 
-			nodeProto.GetTransform().SetParent(node.ref);
+// Queue the hashing of the textures of the materials bound to the exported geometries ahead of the traversal, which then only waits for the
+// textures not hashed yet when it exports a material. The textures in the unloaded payloads are queued when their material is exported.
+static void QueueBoundTextures(const pxr::UsdPrim &root, const Config &config) {
+	TraceScope trace_scope("QueueBoundTextures", root.GetPath());
 
-			if (GetOutputPath(out_path_proto, config.base_output_path, protoName, {}, "scn", config.import_policy_scene))
-				SaveSceneJsonToFile(out_path_proto.c_str(), sceneProto, resources);
+	std::set<pxr::SdfPath> materials;
 
-			out_path_proto = MakeRelativeResourceName(out_path_proto, config.prj_path, config.prefix);
-			protoToInstance[protoName] = out_path_proto;
+	auto range = pxr::UsdPrimRange(root, pxr::UsdTraverseInstanceProxies(export_predicate));
+	for (auto i = range.begin(); i != range.end(); ++i) {
+		if (IsExcluded((*i).GetPath(), config)) {
+			i.PruneChildren();
+			continue;
 		}
 
-		node.SetInstance(scene.CreateInstance(out_path_proto));
+		const auto type = (*i).GetTypeName();
+		if (type != "Mesh" && type != "GeomSubset")
+			continue;
+
+		const auto material = pxr::UsdShadeMaterialBindingAPI(*i).GetDirectBinding().GetMaterial();
+		if (material && materials.insert(material.GetPath()).second)
+			if (const auto shader = GetMaterialSurfaceShader(material))
+				QueueMaterialTextures(shader, config);
 	}
-	else
-		for (auto c : p.GetChildren())
-			ExportNode(c, &node, scene, config, resources);
+}
 
-	// Set the matrix
-	node.GetTransform().SetLocal(m);
+static bool IsInstancerPrototype(const pxr::SdfPath &path) { return instancer_prototypes.count(path) != 0; }
+
+// The children of a point instancer are its prototypes, they are exported to their own scenes by ExportPointInstancer.
+static bool ExportsChildren(const pxr::UsdPrim &p) { return p.GetTypeName() != "PointInstancer"; }
+
+// Export a prim and its descendants. When streaming payloads, an unloaded payload is only loaded for the time of its export so that the
+// memory used is bounded by the largest payload.
+static void ExportPrimTree(pxr::UsdPrim p, hg::Node *nodeParent, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+	const auto stage = p.GetStage();
+	const auto path = p.GetPath();
+
+	if (IsExcluded(path, config))
+		return;
+
+	const bool stream = config.stream_payloads && IsUnloadedPayload(p);
+	if (stream) {
+		TraceScope trace_scope("LoadPayload", path);
+		p = stage->Load(path, pxr::UsdLoadWithoutDescendants); // nested payloads are streamed in turn
+		FindInstancerPrototypes(p);
+
+		if (incremental.enabled)
+			FingerprintLayers(*stage);
+	}
+
+	auto node = ExportNode(p, nodeParent, scene, config, resources);
+	if (node.IsValid() && ExportsChildren(p))
+		ExportPrims(p, &node, scene, config, resources);
+
+	if (stream) {
+		geometry_pool.Wait(); // the geometry workers read the payload prims
+
+		TraceScope trace_scope("UnloadPayload", path);
+		stage->Unload(path);
+	}
 }
 
-static bool ImportUSDScene(const std::string &path, const Config &config) {
-	const auto t_start = hg::time_now();
+// Export the prim at path then the prims following it in the traversal of root, nodes holds the nodes of its ancestors below root. Used
+// once the stage changed under a traversal, the prims left to export are found from their paths.
+static void ExportPrimsFrom(pxr::SdfPath path, const pxr::UsdPrim &root, hg::Node *nodeRoot, std::vector<hg::Node> &nodes, hg::Scene &scene,
+	const Config &config, hg::PipelineResources &resources) {
+	const auto stage = root.GetStage();
+
+	ExportPrimTree(stage->GetPrimAtPath(path), nodes.empty() ? nodeRoot : &nodes.back(), scene, config, resources);
+
+	for (;;) {
+		const auto parent = path.GetParentPath();
+
+		std::vector<pxr::SdfPath> siblings; // following path
+		bool following = false;
+		for (const auto &c : stage->GetPrimAtPath(parent).GetFilteredChildren(export_predicate)) {
+			if (following)
+				siblings.push_back(c.GetPath());
+			following = following || c.GetPath() == path;
+		}
+
+		for (const auto &sibling : siblings)
+			if (!IsInstancerPrototype(sibling))
+				ExportPrimTree(stage->GetPrimAtPath(sibling), nodes.empty() ? nodeRoot : &nodes.back(), scene, config, resources);
+
+		if (parent == root.GetPath())
+			break;
+
+		nodes.pop_back();
+		path = parent;
+	}
+}
+
+// Export the descendants of a prim in a single traversal, Material and Shader subtrees as well as the excluded prims are pruned. The children
+// of an instance or a point instancer are not traversed, their prototypes are exported to their own scenes by ExportNode.
+static void ExportPrims(const pxr::UsdPrim &root, hg::Node *nodeRoot, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+	std::vector<hg::Node> nodes; // nodes of the prims from root to the current prim
+
+	const auto range = pxr::UsdPrimRange::PreAndPostVisit(root, export_predicate);
+	for (auto i = range.begin(); i != range.end(); ++i) {
+		if (*i == root)
+			continue;
+
+		if (i.IsPostVisit()) {
+			nodes.pop_back();
+			continue;
+		}
+
+		if (IsExcluded((*i).GetPath(), config) || IsInstancerPrototype((*i).GetPath())) {
+			i.PruneChildren();
+			nodes.push_back({});
+			continue;
+		}
+
+		// loading a payload changes the stage under the range, the traversal goes on from the prim paths
+		if (config.stream_payloads && IsUnloadedPayload(*i)) {
+			ExportPrimsFrom((*i).GetPath(), root, nodeRoot, nodes, scene, config, resources);
+			return;
+		}
+
+		auto node = ExportNode(*i, nodes.empty() ? nodeRoot : &nodes.back(), scene, config, resources);
+		if (!node.IsValid() || !ExportsChildren(*i))
+			i.PruneChildren();
+		nodes.push_back(node);
+	}
+}
+
+// Load the scene saved by the previous incremental import without its resources, they are only referenced by name. Returns false if there
+// is no previous scene or if it can not be patched, the stage is then exported in full.
+static bool LoadPreviousScene(hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+	if (!incremental.enabled || !incremental.previous.is_object() || incremental.options_changed || !incremental.previous.value("patchable", false) ||
+		config.stream_payloads)
+		return false;
+
+	const auto path = incremental.previous.value("scene", std::string());
+	if (path.empty() || !hg::Exists(path.c_str()))
+		return false;
+
+	TraceScope trace_scope("LoadPreviousScene");
+
+	hg::LoadSceneContext ctx;
+	const uint32_t flags = hg::LSSF_All | hg::LSSF_DoNotLoadResources;
+	const bool loaded = config.scene_format == SceneFormat::Binary
+							? hg::LoadSceneBinaryFromFile(path.c_str(), scene, resources, hg::GetForwardPipelineInfo(), ctx, flags)
+							: hg::LoadSceneJsonFromFile(path.c_str(), scene, resources, hg::GetForwardPipelineInfo(), ctx, flags);
+	if (!loaded) {
+		hg::warn(hg::format("Failed to load the previous scene '%1', exporting the whole stage").arg(path));
+		scene.Clear();
+		return false;
+	}
+
+	// the materials of the kept nodes are not converted again, their entries carry over
+	incremental.materials = incremental.previous.value("materials", json::object());
+	return true;
+}
+
+// Nodes of a loaded scene by prim path, the nodes are named after their prim and parented as the prims are.
+static std::multimap<std::string, hg::NodeRef> GetNodesByPrimPath(const hg::Scene &scene) {
+	std::multimap<std::string, hg::NodeRef> nodes;
+	for (auto node : scene.GetAllNodes()) {
+		std::string path;
+		for (auto n = node; n.IsValid(); n = scene.GetNode(n.GetTransform().GetParent()))
+			path = "/" + n.GetName() + path;
+		nodes.emplace(path, node.ref);
+	}
+	return nodes;
+}
+
+// Destroy the node of a prim and the nodes below it.
+static void DestroyNodeTree(hg::Scene &scene, std::multimap<std::string, hg::NodeRef> &nodes, const std::string &path) {
+	const auto destroy = [&](std::multimap<std::string, hg::NodeRef>::iterator first, std::multimap<std::string, hg::NodeRef>::iterator last) {
+		for (auto i = first; i != last; ++i)
+			scene.DestroyNode(i->second);
+		nodes.erase(first, last);
+	};
+
+	const auto own = nodes.equal_range(path);
+	destroy(own.first, own.second);
+	destroy(nodes.lower_bound(path + "/"), nodes.lower_bound(path + "0")); // '0' follows '/'
+}
+
+// Patch the scene loaded from the previous incremental import: the prims whose layers changed and the new prims are exported again with
+// their descendants, the nodes of the removed prims are destroyed and the other nodes are kept as loaded, without visiting their prims
+// beyond their layers. Returns the number of patched prims.
+static size_t PatchScene(const pxr::UsdStageRefPtr &stage, hg::Scene &scene, const Config &config, hg::PipelineResources &resources) {
+	TraceScope trace_scope("PatchScene");
+
+	auto nodes = GetNodesByPrimPath(scene);
+	const json no_entries = json::object();
+	const auto &previous_prims = incremental.previous.contains("prims") ? incremental.previous["prims"] : no_entries;
+	const auto &previous_geometries = incremental.previous.contains("geometries") ? incremental.previous["geometries"] : no_entries;
+
+	size_t patched = 0;
+
+	const auto root = stage->GetPseudoRoot();
+	const auto range = pxr::UsdPrimRange(root, export_predicate);
+	for (auto i = range.begin(); i != range.end(); ++i) {
+		const auto p = *i;
+		if (p == root)
+			continue;
+
+		const auto type = p.GetTypeName();
+		if (IsExcluded(p.GetPath(), config) || IsInstancerPrototype(p.GetPath()) || type == "Material" || type == "Shader") {
+			i.PruneChildren(); // not exported as nodes, see ExportNode
+			continue;
+		}
+
+		const auto key = p.GetPath().GetString();
+		if (UpdateScenePrimManifest(p) && nodes.count(key)) {
+			const auto geometry = previous_geometries.find(key);
+			if (geometry != previous_geometries.end())
+				incremental.geometries[key] = *geometry;
+
+			if (!ExportsChildren(p))
+				i.PruneChildren();
+			continue;
+		}
+
+		// its parent node was kept, unless it is a root prim
+		hg::Node nodeParent;
+		const auto parent_path = p.GetPath().GetParentPath();
+		if (parent_path != pxr::SdfPath::AbsoluteRootPath())
+			nodeParent = scene.GetNode(nodes.find(parent_path.GetString())->second);
+
+		hg::debug(hg::format("Patching the node of '%1'").arg(key));
+		DestroyNodeTree(scene, nodes, key);
+		ExportPrimTree(p, nodeParent.IsValid() ? &nodeParent : nullptr, scene, config, resources);
+		++patched;
+
+		i.PruneChildren();
+	}
+
+	for (const auto &[key, entry] : previous_prims.items())
+		if (!incremental.prims.contains(key) && nodes.count(key)) {
+			hg::debug(hg::format("Removing the node of '%1'").arg(key));
+			DestroyNodeTree(scene, nodes, key);
+			++patched;
+		}
+
+	scene.GarbageCollect();
+	hg::log(hg::format("Incremental import: %1 prim(s) patched in the previous scene").arg(patched));
+	return patched;
+}
+
+// Clear the state shared by the conversion of a scene, so that several scenes can be imported by the same process.
+static void ResetImportState() {
+	reserved_output_paths.clear();
+	picture_asset_path_to_tex_ref.Clear();
+	picture_sha1_to_tex_ref.Clear();
+	already_saved_geo_with_primitives_ids.clear();
+	primToObject.Clear();
+	transform_animations.clear();
+	skel_cache.Clear();
+	skin_bindings.Clear();
+	scene_skeletons.clear();
+	scene_instance_arrays.clear();
+	instancer_prototypes.clear();
+	prim_fingerprints.clear();
+	geometry_bounds.clear();
+	scene_bounds.clear();
+	finished_scene_bounds.clear();
+	layer_stack_by_address.Clear();
+	layer_stack_by_identifier.Clear();
+	geometry_instances.clear();
+	protoToInstance.Clear();
+	converted_materials.clear();
+	texture_jobs.clear();
+	incremental = {};
+}
 
+//
+static bool ImportUSDStage(const pxr::UsdStageRefPtr &stage, const std::string &scene_name, const Config &config) {
 	if (config.base_output_path.empty())
 		return false;
 	// create output directory if missing
@@ -988,8 +5124,6 @@ static bool ImportUSDScene(const std::string &path, const Config &config) {
 	hg::Scene scene;
 	hg::PipelineResources resources;
 
-	//
-	auto stage = pxr::UsdStage::Open(path);
 	//auto stage = pxr::UsdStage::Open("C:\\boulot\\works\\Harfang\\couch.usda");
 	//auto stage = pxr::UsdStage::Open("C:\\Users\\Scorpheus\\Downloads\\island-usd-v2.0\\island-usd-v2.0\\island\\usd\\elements\\isBayCedarA1\\element.usda");
 	
@@ -1009,91 +5143,46 @@ static bool ImportUSDScene(const std::string &path, const Config &config) {
 	//std::vector<std::string> unresolvedPaths;
 	//pxr::UsdUtilsComputeAllDependencies(pxr::SdfAssetPath(path), &layers, &assets, &unresolvedPaths);
 
-	// save all textures
-	for (const auto &p : stage->TraverseAll()) {
-		// look for usdUvTexture in all prim
-		if (pxr::UsdAttribute attr = p.GetAttribute(pxr::UsdShadeTokens->infoId)) {
-			pxr::TfToken infoId;
-			attr.Get(&infoId);
-			if (infoId.GetString() == "UsdUVTexture") {//infoId == pxr::UsdHydraTokens->HwUvTexture_1) { // || infoId == pxr::UsdHydraTokens->HwPtexTexture_1) {
-				// look for the filename
-				pxr::UsdShadeShader shaderTexture(p);
-				for (const auto &input : shaderTexture.GetInputs()) {
-					auto baseName = input.GetBaseName().GetString();
-					auto attrTexture = input.GetAttr();
-					auto y = attrTexture.GetTypeName().GetCPPTypeName();
-
-					if (baseName == "file") {
-						// Retrieve the asset file.
-						pxr::SdfAssetPath assetPath;
-						attrTexture.Get(&assetPath, 0);
-
-					//	pxr::ArResolverContextBinder resolverContextBinder(p.GetStage()->GetPathResolverContext());
-						pxr::ArResolver &resolver = pxr::ArGetResolver();
-						resolver.RefreshContext(p.GetStage()->GetPathResolverContext());
-
-						// FIXME: Arbitrarily replace <UDIM> with 1001. Currently unsure how to resolve this.
-						if (assetPath.GetResolvedPath() == "") {
-							std::string assetPathToCheck = assetPath.GetAssetPath();
-							hg::replace_all(assetPathToCheck, "<UDIM>", "1001");
-							auto resolvedPath = resolver.Resolve(assetPathToCheck);
-							assetPath = pxr::SdfAssetPath(assetPath.GetAssetPath(), resolvedPath);
-						}
+	if (config.incremental) {
+		LoadIncrementalManifest(stage, hg::CleanPath(config.base_output_path + "/" + scene_name + ".import.json"), config);
+		incremental.scene = &scene;
+	}
 
-						if (assetPath.GetResolvedPath() != "") {
-							// Retrieve the texture.
-							auto textureAsset = resolver.OpenAsset(pxr::ArResolvedPath(assetPath.GetResolvedPath()));
-							std::string dst_path;
-							auto findOutputPath = GetOutputPath(dst_path, config.base_output_path + "/Textures", hg::GetFileName(assetPath.GetAssetPath()), {},
-								hg::GetFileExtension(assetPath.GetAssetPath()), config.import_policy_texture);
-
-							// Retrieve the SHA1 hash of this texture and check if we already have it.
-							auto sha1Picture = hg::ComputeSHA1String(textureAsset->GetBuffer().get(), textureAsset->GetSize());
-							// If the SHA1 hash is not found, import the texture.
-							if (picture_sha1_to_dest_path.find(sha1Picture) == picture_sha1_to_dest_path.end()) {
-								picture_sha1_to_dest_path[sha1Picture] = dst_path;
-
-								if (findOutputPath) {
-									auto myfile = std::fstream(dst_path, std::ios::out | std::ios::binary);
-									myfile.write(textureAsset->GetBuffer().get(), textureAsset->GetSize());
-									myfile.close();
-								}
+	if (!config.cache_dir.empty() && content_cache.Open(config.cache_dir))
+		hg::debug(hg::format("Using content cache '%1'").arg(config.cache_dir));
 
-								// Add ".meta" to ignore this texture from assetc (if it is used by a material, it will be overwritten).
-								std::string dst_path_meta;
-								if (GetOutputPath(dst_path_meta, config.base_output_path + "/Textures", hg::CutFilePath(assetPath.GetAssetPath()), {}, "meta", config.import_policy_texture)) {
-									if (std::FILE *f = std::fopen(dst_path_meta.c_str(), "w")) {
-										static const std::string meta_ignore_texture("{\"profiles\": {\"default\": {\"type\": \"Ignore\"}}}");
-										std::fwrite(meta_ignore_texture.data(), sizeof meta_ignore_texture[0], meta_ignore_texture.size(), f);
-										std::fclose(f);
-									}
-								}
+	// Export nodes, textures are imported by the materials referencing them and geometries are converted by the worker pools while the
+	// traversal goes on.
+	geometry_pool.Start(config.jobs);
+	texture_pool.Start(config.jobs);
+	output_writer.Start(config.writers, config.write_budget);
+	hg::debug(hg::format("Converting geometries using %1 worker thread(s)").arg(std::max<size_t>(geometry_pool.GetWorkerCount(), 1)));
+	hg::debug(hg::format("Writing files using %1 writer thread(s)").arg(output_writer.GetWriterCount()));
 
-								// Keep the saved texture.
-								uint32_t flags = BGFX_SAMPLER_NONE;
-								std::string dst_rel_path = MakeRelativeResourceName(dst_path, config.prj_path, config.prefix);
-								auto text_ref = resources.textures.Add(dst_rel_path.c_str(), { flags, BGFX_INVALID_HANDLE });
+	FindInstancerPrototypes(stage->GetPseudoRoot());
 
-								// Cache the texture path to the texture reference.
-								picture_dest_path_to_tex_ref[dst_path] = text_ref;
-							}
-							else {
-								// Retrieve the texture reference from the cached SHA1 and report it to the cache texture reference.
-								picture_dest_path_to_tex_ref[dst_path] = picture_dest_path_to_tex_ref[picture_sha1_to_dest_path[sha1Picture]];
-							}
-						} else
-							hg::error(hg::format("Can't find asset with path %1").arg(assetPath.GetAssetPath()));
-					}
-				}
-			}
-		}
-	}
+	// an incremental import only hashes the textures of the materials it exports again
+	if (!incremental.enabled || incremental.previous.is_null())
+		QueueBoundTextures(stage->GetPseudoRoot(), config);
 
-	// Export nodes.
-	auto children = stage->GetPseudoRoot().GetChildren();
-	for (auto p : children) {
-		ExportNode(p, nullptr, scene, config, resources);
-	}
+	// an incremental import patches the scene of the previous run when it can
+	bool scene_up_to_date = !incremental.HasChanges();
+	if (LoadPreviousScene(scene, config, resources))
+		scene_up_to_date = PatchScene(stage, scene, config, resources) == 0;
+	else
+		ExportPrims(stage->GetPseudoRoot(), nullptr, scene, config, resources);
+
+	// the nodes of a scene referenced from outside of it by prim or by joint order can not be patched by the next run
+	bool patchable = !config.stream_payloads && !config.scene_bvh && !scene_skeletons.count(&scene) && !scene_instance_arrays.count(&scene);
+
+	BindSkinnedObjects(scene);
+	patchable = !AddTransformAnimations(scene, scene_name, config) && patchable;
+	SaveInstanceArrayList(scene, scene_name, config);
+
+	geometry_pool.Wait();
+	geometry_pool.Stop();
+	texture_pool.Wait();
+	texture_pool.Stop();
 
 	// Add default PBR map.
 	scene.environment.brdf_map = resources.textures.Add("core/pbr/brdf.dds", {BGFX_SAMPLER_NONE, BGFX_INVALID_HANDLE});
@@ -1101,10 +5190,59 @@ static bool ImportUSDScene(const std::string &path, const Config &config) {
 	scene.environment.probe.radiance_map = resources.textures.Add("core/pbr/probe.hdr.radiance", {BGFX_SAMPLER_NONE, BGFX_INVALID_HANDLE});
 
 	std::string out_path;
-	if (GetOutputPath(out_path, config.base_output_path,
-			config.name.empty() ? hg::GetFileName(path) : config.name, {}, "scn",
-			config.import_policy_scene))
-		SaveSceneJsonToFile(out_path.c_str(), scene, resources);
+	const bool save =
+		GetOutputPath(out_path, config.base_output_path, scene_name, {}, GetSceneExtension(config), GetIncrementalPolicy(config.import_policy_scene, scene_up_to_date));
+	if (save)
+		output_writer.Write(out_path, 0, [&](const std::string &path) { return SaveScene(path, scene, resources, config); });
+
+	if (config.scene_bvh) {
+		FinishSceneBounds(scene, scene_name, save ? out_path : std::string());
+		WriteSceneBVHs();
+	}
+
+	if (incremental.enabled)
+		SaveIncrementalManifest(out_path, patchable);
+
+	const bool written = output_writer.Flush();
+	output_writer.Stop();
+	if (!written)
+		return false;
+
+	if (content_cache.IsOpen())
+		hg::log(hg::format("Geometry cache: %1 hit(s), %2 miss(es)").arg(content_cache.GetHitCount()).arg(content_cache.GetMissCount()));
+
+	return true;
+}
+
+static bool ImportUSDScene(const std::string &path, const Config &config) {
+	const auto t_start = hg::time_now();
+
+	pxr::UsdStageRefPtr stage;
+	{
+		TraceScope trace_scope("UsdStage::Open");
+		const auto load = config.stream_payloads ? pxr::UsdStage::LoadNone : pxr::UsdStage::LoadAll;
+
+		if (config.include_paths.empty()) {
+			stage = pxr::UsdStage::Open(path, load);
+		} else {
+			// only compose the included prims, along with the materials they are bound to
+			pxr::UsdStagePopulationMask mask;
+			for (const auto &include_path : config.include_paths)
+				mask.Add(include_path);
+
+			stage = pxr::UsdStage::OpenMasked(path, mask, load);
+			if (stage)
+				stage->ExpandPopulationMask();
+		}
+	}
+
+	if (!stage) {
+		hg::error(hg::format("Failed to open USD stage '%1'").arg(path));
+		return false;
+	}
+
+	if (!ImportUSDStage(stage, config.name.empty() ? hg::GetFileName(path) : config.name, config))
+		return false;
 
 	hg::log(hg::format("Import complete, took %1 ms").arg(hg::time_to_ms(hg::time_now() - t_start)));
 	return true;
@@ -1123,6 +5261,29 @@ static ImportPolicy ImportPolicyFromString(const std::string &v) {
 	return ImportPolicy::SkipExisting;
 }
 
+// Comma separated list of absolute prim paths.
+static bool PrimPathListFromString(const std::string &v, std::vector<pxr::SdfPath> &paths) {
+	for (const auto &path : hg::split(v, ",")) {
+		if (path.empty())
+			continue;
+
+		const pxr::SdfPath prim_path(path);
+		if (!prim_path.IsAbsolutePath() || !prim_path.IsPrimPath()) {
+			hg::error(hg::format("Invalid prim path '%1'").arg(path));
+			return false;
+		}
+		paths.push_back(prim_path);
+	}
+	return true;
+}
+
+static SceneFormat SceneFormatFromString(const std::string &v) {
+	if (v == "binary")
+		return SceneFormat::Binary;
+
+	return SceneFormat::Json;
+}
+
 static void OutputUsage(const hg::CmdLineFormat &cmd_format) {
 	hg::debug((std::string("Usage: usd_importer ") + hg::word_wrap(hg::FormatCmdLineArgs(cmd_format), 80, 21) + "\n").c_str());
 	hg::debug((hg::FormatCmdLineArgsDescription(cmd_format)).c_str());
@@ -1130,6 +5291,8 @@ static void OutputUsage(const hg::CmdLineFormat &cmd_format) {
 
 //
 static std::mutex log_mutex;
+
+#ifndef USD_IMPORTER_NO_MAIN
 static bool quiet = false;
 
 int main(int argc, const char **argv) {
@@ -1150,8 +5313,14 @@ int main(int argc, const char **argv) {
 		{
 			{"-recalculate-normal", "Recreate the vertex normals of exported geometries"},
 			{"-recalculate-tangent", "Recreate the vertex tangent frames of exported geometries"},
-			{"-detect-geometry-instances", "Detect and optimize geometry instances"},
+			{"-optimize-mesh", "Weld the vertices of exported geometries and reorder their triangles and vertices for the GPU"},
+			{"-quantize-geometry", "Also save each geometry with quantized vertex attributes to a .qgeo file"},
+			{"-detect-geometry-instances", "Share the geometry of the meshes with the same content, including the meshes only differing by a rigid transform"},
 			{"-anim-to-file", "Scene animations will be exported to separate files and not embedded in scene"},
+			{"-incremental", "Only export the prims, geometries and materials changed since the previous import of this scene, and patch its scene"},
+			{"-stream-payloads", "Load the payloads one at a time during the export, for stages that do not fit in memory"},
+			{"-instancer-arrays", "Save the point instancer transforms to .instances files, listed in <scene>.instances.json, instead of creating a node per instance"},
+			{"-scene-bvh", "Save a bounding volume hierarchy of the node bounds next to each scene, as a .bvh file"},
 			{"-quiet", "Quiet log, only log errors"},
 		},
 		{
@@ -1171,6 +5340,17 @@ int main(int argc, const char **argv) {
 			{"-geometry-scale", "Factor used to scale exported geometries", true},
 			{"-finalizer-script", "Path to the Lua finalizer script", true},
 			{"-shader", "Material pipeline shader [default=core/shader/pbr.hps]", true},
+			{"-jobs", "Number of worker threads used to convert geometries [default=number of hardware threads]", true},
+			{"-cache-dir", "Content cache directory shared between import runs, unchanged geometries and textures are not converted again", true},
+			{"-include", "Comma separated list of the prims to import, the rest of the stage is not composed [default=all prims]", true},
+			{"-exclude", "Comma separated list of the prims not to import", true},
+			{"-scene-format", "Scene file format (json or binary), binary scenes are saved with the .scnb extension [default=json]", true},
+			{"-trace", "Save a timeline of the import phases to this file (Chrome trace event format)", true},
+			{"-writers", "Number of threads writing the output files, 0 to write them on the import thread [default=4]", true},
+			{"-write-budget", "Memory in MB held by the output files waiting to be written, the import waits when it is exceeded [default=256]", true},
+			{"-anim-tolerance", "Keyframe reduction tolerance, in meters for positions and radians for rotations [default=0.001]", true},
+			{"-lod-count", "Number of simplified levels of detail saved next to each exported geometry [default=0]", true},
+			{"-lod-ratio", "Triangle count of a level of detail relative to the previous level [default=0.5]", true},
 		},
 		{
 			{"input", "Input FBX file to convert"},
@@ -1205,14 +5385,38 @@ int main(int argc, const char **argv) {
 	config.import_policy_anim = ImportPolicyFromString(hg::GetCmdLineSingleValue(cmd_content, "-anim-policy", "skip"));
 
 	config.geometry_scale = hg::GetCmdLineSingleValue(cmd_content, "-geometry-scale", 1.f);
+	config.scene_format = SceneFormatFromString(hg::GetCmdLineSingleValue(cmd_content, "-scene-format", "json"));
+
+	if (!PrimPathListFromString(hg::GetCmdLineSingleValue(cmd_content, "-include", ""), config.include_paths) ||
+		!PrimPathListFromString(hg::GetCmdLineSingleValue(cmd_content, "-exclude", ""), config.exclude_paths)) {
+		OutputUsage(cmd_format);
+		return -3;
+	}
 
 	config.recalculate_normal = hg::GetCmdLineFlagValue(cmd_content, "-recalculate-normal");
 	config.recalculate_tangent = hg::GetCmdLineFlagValue(cmd_content, "-recalculate-tangent");
+	config.detect_geometry_instances = hg::GetCmdLineFlagValue(cmd_content, "-detect-geometry-instances");
+	config.optimize_mesh = hg::GetCmdLineFlagValue(cmd_content, "-optimize-mesh");
+	config.quantize_geometry = hg::GetCmdLineFlagValue(cmd_content, "-quantize-geometry");
+	config.incremental = hg::GetCmdLineFlagValue(cmd_content, "-incremental");
+	config.stream_payloads = hg::GetCmdLineFlagValue(cmd_content, "-stream-payloads");
+	config.instancer_arrays = hg::GetCmdLineFlagValue(cmd_content, "-instancer-arrays");
+	config.scene_bvh = hg::GetCmdLineFlagValue(cmd_content, "-scene-bvh");
 
 	config.finalizer_script = hg::GetCmdLineSingleValue(cmd_content, "-finalizer-script", "");
 
 	config.shader = hg::GetCmdLineSingleValue(cmd_content, "-shader", "");
 
+	config.jobs = hg::GetCmdLineSingleValue(cmd_content, "-jobs", int(std::max(std::thread::hardware_concurrency(), 1u)));
+	config.cache_dir = hg::GetCmdLineSingleValue(cmd_content, "-cache-dir", "");
+	config.trace_path = hg::GetCmdLineSingleValue(cmd_content, "-trace", "");
+	config.writers = std::max(hg::GetCmdLineSingleValue(cmd_content, "-writers", 4), 0);
+	config.write_budget = size_t(std::max(hg::GetCmdLineSingleValue(cmd_content, "-write-budget", 256), 1)) << 20;
+	config.anim_to_file = hg::GetCmdLineFlagValue(cmd_content, "-anim-to-file");
+	config.anim_tolerance = std::max(hg::GetCmdLineSingleValue(cmd_content, "-anim-tolerance", 0.001f), 0.f);
+	config.lod_count = std::max(hg::GetCmdLineSingleValue(cmd_content, "-lod-count", 0), 0);
+	config.lod_ratio = std::clamp(hg::GetCmdLineSingleValue(cmd_content, "-lod-ratio", 0.5f), 0.01f, 0.99f);
+
 	quiet = hg::GetCmdLineFlagValue(cmd_content, "-quiet");
 
 	//
@@ -1224,10 +5428,18 @@ int main(int argc, const char **argv) {
 
 	//
 	config.input_path = cmd_content.positionals[0];
+
+	if (!config.trace_path.empty())
+		trace.Start();
+
 	auto res = ImportUSDScene(cmd_content.positionals[0], config);
 
+	if (trace.IsEnabled() && !trace.Save(config.trace_path))
+		hg::error(hg::format("Failed to save trace to '%1'").arg(config.trace_path));
+
 	const auto msg = std::string("[ImportScene") + std::string(res ? ": OK]" : ": KO]");
 	hg::log(msg.c_str());
 
 	return res ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+#endif // USD_IMPORTER_NO_MAIN
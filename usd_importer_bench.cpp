@@ -0,0 +1,293 @@
+// Harfang Framework - Copyright 2001-2023 Thomas Simonnet. All Rights Reserved.
+// USD importer benchmark on procedurally generated stages.
+
+#define USD_IMPORTER_NO_MAIN
+#include "usd_importer.cpp"
+
+#include "pxr/usd/usdGeom/primvarsAPI.h"
+#include "pxr/usd/usdGeom/subset.h"
+#include "pxr/usd/usdGeom/xform.h"
+#include "pxr/usd/usdShade/material.h"
+#include "pxr/usd/usdShade/shader.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+struct Workload {
+	int meshes{100};
+	int faces{1000}; // per mesh
+	int subsets{0}; // per mesh
+	int instances{0};
+	int textures{0};
+	int texture_size{256}; // in KB
+	int depth{4};
+};
+
+// Texture contents are never decoded by the importer, random bytes stand in for the pictures.
+static std::vector<std::string> CreateTextureFiles(const std::string &dir, const Workload &workload) {
+	std::vector<std::string> paths;
+	std::mt19937 rng(1);
+	std::vector<char> data(size_t(workload.texture_size) * 1024);
+
+	std::filesystem::create_directories(dir);
+	for (int i = 0; i < workload.textures; ++i) {
+		for (auto &c : data)
+			c = char(rng());
+
+		const auto path = hg::CleanPath(std::filesystem::absolute(dir).string() + "/texture_" + std::to_string(i) + ".png");
+		std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+		paths.push_back(path);
+	}
+	return paths;
+}
+
+// UsdPreviewSurface with an optional diffuse texture read with the "st" primvar.
+static pxr::UsdShadeMaterial CreateMaterial(pxr::UsdStageRefPtr stage, const pxr::SdfPath &path, const std::string &texture_path) {
+	auto material = pxr::UsdShadeMaterial::Define(stage, path);
+
+	auto surface = pxr::UsdShadeShader::Define(stage, path.AppendChild(pxr::TfToken("UsdPreviewSurface")));
+	surface.CreateIdAttr(pxr::VtValue(pxr::TfToken("UsdPreviewSurface")));
+	surface.CreateInput(pxr::TfToken("roughness"), pxr::SdfValueTypeNames->Float).Set(0.5f);
+	material.CreateSurfaceOutput().ConnectToSource(surface.ConnectableAPI(), pxr::TfToken("surface"));
+
+	if (texture_path.empty()) {
+		surface.CreateInput(pxr::TfToken("diffuseColor"), pxr::SdfValueTypeNames->Color3f).Set(pxr::GfVec3f(0.8f, 0.8f, 0.8f));
+		return material;
+	}
+
+	auto reader = pxr::UsdShadeShader::Define(stage, path.AppendChild(pxr::TfToken("STReader")));
+	reader.CreateIdAttr(pxr::VtValue(pxr::TfToken("UsdPrimvarReader_float2")));
+	reader.CreateInput(pxr::TfToken("varname"), pxr::SdfValueTypeNames->Token).Set(pxr::TfToken("st"));
+	reader.CreateOutput(pxr::TfToken("result"), pxr::SdfValueTypeNames->Float2);
+
+	auto texture = pxr::UsdShadeShader::Define(stage, path.AppendChild(pxr::TfToken("DiffuseTexture")));
+	texture.CreateIdAttr(pxr::VtValue(pxr::TfToken("UsdUVTexture")));
+	texture.CreateInput(pxr::TfToken("file"), pxr::SdfValueTypeNames->Asset).Set(pxr::SdfAssetPath(texture_path));
+	texture.CreateInput(pxr::TfToken("st"), pxr::SdfValueTypeNames->Float2).ConnectToSource(reader.ConnectableAPI(), pxr::TfToken("result"));
+	texture.CreateOutput(pxr::TfToken("rgb"), pxr::SdfValueTypeNames->Float3);
+
+	surface.CreateInput(pxr::TfToken("diffuseColor"), pxr::SdfValueTypeNames->Color3f).ConnectToSource(texture.ConnectableAPI(), pxr::TfToken("rgb"));
+	return material;
+}
+
+// Grid of quads with vertex normals and uvs, split in faces subsets when requested.
+static pxr::UsdGeomMesh CreateMesh(pxr::UsdStageRefPtr stage, const pxr::SdfPath &path, int face_count, int subset_count,
+	const std::vector<pxr::UsdShadeMaterial> &materials, size_t material_index) {
+	const int side = std::max(int(std::ceil(std::sqrt(double(face_count)))), 1);
+
+	pxr::VtVec3fArray points, normals;
+	pxr::VtVec2fArray uvs;
+	for (int y = 0; y <= side; ++y)
+		for (int x = 0; x <= side; ++x) {
+			points.push_back(pxr::GfVec3f(float(x) / side, 0.f, float(y) / side));
+			normals.push_back(pxr::GfVec3f(0.f, 1.f, 0.f));
+			uvs.push_back(pxr::GfVec2f(float(x) / side, float(y) / side));
+		}
+
+	pxr::VtIntArray face_vertex_counts, face_vertex_indices;
+	for (int i = 0; i < face_count; ++i) {
+		const int x = i % side, y = i / side, v = y * (side + 1) + x;
+		face_vertex_counts.push_back(4);
+		for (const int idx : {v, v + side + 1, v + side + 2, v + 1})
+			face_vertex_indices.push_back(idx);
+	}
+
+	auto mesh = pxr::UsdGeomMesh::Define(stage, path);
+	mesh.CreatePointsAttr().Set(points);
+	mesh.CreateNormalsAttr().Set(normals);
+	mesh.SetNormalsInterpolation(pxr::UsdGeomTokens->vertex);
+	mesh.CreateFaceVertexCountsAttr().Set(face_vertex_counts);
+	mesh.CreateFaceVertexIndicesAttr().Set(face_vertex_indices);
+	pxr::UsdGeomPrimvarsAPI(mesh).CreatePrimvar(pxr::TfToken("st"), pxr::SdfValueTypeNames->TexCoord2fArray, pxr::UsdGeomTokens->vertex).Set(uvs);
+
+	if (!materials.empty())
+		pxr::UsdShadeMaterialBindingAPI::Apply(mesh.GetPrim()).Bind(materials[material_index % materials.size()]);
+
+	for (int s = 0; s < subset_count; ++s) {
+		pxr::VtIntArray indices;
+		for (int i = s; i < face_count; i += subset_count)
+			indices.push_back(i);
+
+		auto subset = pxr::UsdGeomSubset::CreateGeomSubset(
+			mesh, pxr::TfToken("subset_" + std::to_string(s)), pxr::UsdGeomTokens->face, indices, pxr::UsdShadeTokens->materialBind);
+		if (!materials.empty())
+			pxr::UsdShadeMaterialBindingAPI::Apply(subset.GetPrim()).Bind(materials[(material_index + s) % materials.size()]);
+	}
+	return mesh;
+}
+
+// Meshes are spread over a binary tree of transforms, instances all reference the same prototype.
+static pxr::UsdStageRefPtr CreateStage(const Workload &workload, const std::vector<std::string> &textures) {
+	auto stage = pxr::UsdStage::CreateInMemory();
+	pxr::UsdGeomSetStageMetersPerUnit(stage, 1.0);
+
+	std::vector<pxr::UsdShadeMaterial> materials;
+	for (size_t i = 0; i < std::max<size_t>(textures.size(), 1); ++i)
+		materials.push_back(CreateMaterial(stage, pxr::SdfPath("/Looks/Material_" + std::to_string(i)), textures.empty() ? std::string() : textures[i]));
+
+	for (int i = 0; i < workload.meshes; ++i) {
+		auto path = pxr::SdfPath("/World");
+		for (int d = 0; d < workload.depth; ++d) {
+			path = path.AppendChild(pxr::TfToken("Group_" + std::to_string((i >> d) & 1)));
+			pxr::UsdGeomXform::Define(stage, path);
+		}
+
+		auto mesh = CreateMesh(stage, path.AppendChild(pxr::TfToken("Mesh_" + std::to_string(i))), workload.faces, workload.subsets, materials, i);
+		mesh.AddTranslateOp().Set(pxr::GfVec3d(i % 32, 0, i / 32));
+	}
+
+	if (workload.instances > 0) {
+		auto prototype = stage->CreateClassPrim(pxr::SdfPath("/_Prototype"));
+		CreateMesh(stage, prototype.GetPath().AppendChild(pxr::TfToken("Mesh")), workload.faces, workload.subsets, materials, 0);
+
+		for (int i = 0; i < workload.instances; ++i) {
+			auto instance = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Instances/Instance_" + std::to_string(i)));
+			instance.GetPrim().GetReferences().AddInternalReference(prototype.GetPath());
+			instance.GetPrim().SetInstanceable(true);
+			instance.AddTranslateOp().Set(pxr::GfVec3d(i % 32, 2, i / 32));
+		}
+	}
+	return stage;
+}
+
+static size_t GetDirectorySize(const std::string &dir) {
+	size_t size = 0;
+	std::error_code ec;
+	for (const auto &entry : std::filesystem::recursive_directory_iterator(dir, ec))
+		if (entry.is_regular_file(ec))
+			size += entry.file_size(ec);
+	return size;
+}
+
+static size_t GetPeakRSS() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return size_t(usage.ru_maxrss); // bytes
+#else
+	return size_t(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+}
+
+//
+int main(int argc, const char **argv) {
+	hg::set_log_hook(
+		[](const char *msg, int mask, const char *details, void *user) {
+			if (!(mask & hg::LL_Error))
+				return; // only report errors, logging would dominate the measures
+
+			std::lock_guard<std::mutex> guard(log_mutex);
+			std::cout << msg << std::endl;
+		},
+		nullptr);
+	hg::set_log_level(hg::LL_All);
+
+	hg::CmdLineFormat cmd_format = {
+		{},
+		{
+			{"-out", "Output directory, its content is deleted before each run [default=usd_importer_bench]", true},
+			{"-meshes", "Number of meshes [default=100]", true},
+			{"-faces", "Number of faces per mesh [default=1000]", true},
+			{"-subsets", "Number of GeomSubsets per mesh [default=0]", true},
+			{"-instances", "Number of native instances of a prototype mesh [default=0]", true},
+			{"-textures", "Number of textured materials [default=0]", true},
+			{"-texture-size", "Size of each texture in KB [default=256]", true},
+			{"-depth", "Depth of the transform hierarchy above the meshes [default=4]", true},
+			{"-runs", "Number of import runs [default=3]", true},
+			{"-jobs", "Number of worker threads used to convert geometries [default=number of hardware threads]", true},
+			{"-trace", "Save a timeline of the last run to this file (Chrome trace event format)", true},
+		},
+		{},
+		{},
+	};
+
+	hg::CmdLineContent cmd_content;
+	if (!hg::ParseCmdLine({argv + 1, argv + argc}, cmd_format, cmd_content)) {
+		OutputUsage(cmd_format);
+		return -1;
+	}
+
+	Workload workload;
+	workload.meshes = hg::GetCmdLineSingleValue(cmd_content, "-meshes", workload.meshes);
+	workload.faces = hg::GetCmdLineSingleValue(cmd_content, "-faces", workload.faces);
+	workload.subsets = hg::GetCmdLineSingleValue(cmd_content, "-subsets", workload.subsets);
+	workload.instances = hg::GetCmdLineSingleValue(cmd_content, "-instances", workload.instances);
+	workload.textures = hg::GetCmdLineSingleValue(cmd_content, "-textures", workload.textures);
+	workload.texture_size = hg::GetCmdLineSingleValue(cmd_content, "-texture-size", workload.texture_size);
+	workload.depth = hg::GetCmdLineSingleValue(cmd_content, "-depth", workload.depth);
+
+	const auto out_dir = hg::CleanPath(hg::GetCmdLineSingleValue(cmd_content, "-out", "usd_importer_bench"));
+	const int runs = std::max(hg::GetCmdLineSingleValue(cmd_content, "-runs", 3), 1);
+	const auto trace_path = hg::GetCmdLineSingleValue(cmd_content, "-trace", "");
+
+	Config config;
+	config.base_output_path = hg::CleanPath(out_dir + "/output");
+	config.prj_path = config.base_output_path;
+	config.name = "bench";
+	config.jobs = hg::GetCmdLineSingleValue(cmd_content, "-jobs", int(std::max(std::thread::hardware_concurrency(), 1u)));
+	config.import_policy_anim = config.import_policy_geometry = config.import_policy_material = config.import_policy_scene = config.import_policy_texture =
+		ImportPolicy::Overwrite;
+
+	// build the workload once, all runs convert the same stage
+	const auto textures = CreateTextureFiles(out_dir + "/textures", workload);
+
+	auto t_build = hg::time_now();
+	auto stage = CreateStage(workload, textures);
+	const auto build_ms = hg::time_to_ms(hg::time_now() - t_build);
+
+	size_t prim_count = 0;
+	for (const auto &p : stage->Traverse()) {
+		(void)p;
+		++prim_count;
+	}
+	const size_t face_count = size_t(workload.meshes + (workload.instances ? 1 : 0)) * workload.faces;
+
+	std::cout << "Workload: " << workload.meshes << " meshes, " << workload.faces << " faces/mesh, " << workload.subsets << " subsets/mesh, "
+			  << workload.instances << " instances, " << workload.textures << " textures, depth " << workload.depth << ", " << config.jobs << " job(s)"
+			  << std::endl;
+	std::cout << "Stage: " << prim_count << " prims, " << face_count << " faces, built in " << build_ms << " ms" << std::endl;
+
+	int64_t best_ms = std::numeric_limits<int64_t>::max();
+	size_t written = 0;
+
+	for (int run = 0; run < runs; ++run) {
+		std::error_code ec;
+		std::filesystem::remove_all(config.base_output_path, ec);
+		ResetImportState();
+
+		if (run == runs - 1 && !trace_path.empty())
+			trace.Start();
+
+		const auto t_start = hg::time_now();
+		if (!ImportUSDStage(stage, config.name, config)) {
+			std::cout << "Import failed" << std::endl;
+			return EXIT_FAILURE;
+		}
+		const auto ms = std::max<int64_t>(hg::time_to_ms(hg::time_now() - t_start), 1);
+
+		written = GetDirectorySize(config.base_output_path);
+		best_ms = std::min(best_ms, ms);
+
+		std::cout << "Run " << run + 1 << ": " << ms << " ms, " << prim_count * 1000 / ms << " prims/s, " << face_count * 1000 / ms << " faces/s, "
+				  << double(written) / (1024 * 1024) << " MB written" << std::endl;
+	}
+
+	if (trace.IsEnabled() && !trace.Save(trace_path))
+		std::cout << "Failed to save trace to '" << trace_path << "'" << std::endl;
+
+	std::cout << "Best: " << best_ms << " ms, " << prim_count * 1000 / best_ms << " prims/s, " << face_count * 1000 / best_ms << " faces/s, "
+			  << double(written) / (1024 * 1024) << " MB written, " << double(GetPeakRSS()) / (1024 * 1024) << " MB peak RSS" << std::endl;
+
+	return EXIT_SUCCESS;
+}
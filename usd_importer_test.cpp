@@ -0,0 +1,416 @@
+// Harfang Framework - Copyright 2001-2023 Thomas Simonnet. All Rights Reserved.
+// USD importer tests on small stages built in memory, run by ctest one test per invocation.
+
+#define USD_IMPORTER_NO_MAIN
+#include "usd_importer.cpp"
+
+#include "pxr/base/gf/rotation.h"
+#include "pxr/usd/sdf/layer.h"
+#include "pxr/usd/usdGeom/xform.h"
+#include "pxr/usd/usdSkel/bindingAPI.h"
+
+#define TEST_CHECK(cond)                                                                                                                             \
+	do {                                                                                                                                             \
+		if (!(cond)) {                                                                                                                               \
+			std::cout << __FILE__ << "(" << __LINE__ << "): check failed: " << #cond << std::endl;                                                   \
+			return false;                                                                                                                            \
+		}                                                                                                                                            \
+	} while (0)
+
+static std::string GetTestOutputPath(const std::string &test) {
+	const auto path = hg::CleanPath((std::filesystem::temp_directory_path() / "usd_importer_test" / test).string());
+	std::error_code ec;
+	std::filesystem::remove_all(path, ec);
+	std::filesystem::create_directories(path, ec);
+	return path;
+}
+
+static Config GetTestConfig(const std::string &out_path) {
+	Config config;
+	config.base_output_path = out_path;
+	config.prj_path = out_path;
+	config.name = "test";
+	config.jobs = 2;
+	config.import_policy_anim = config.import_policy_geometry = config.import_policy_material = config.import_policy_scene = config.import_policy_texture =
+		ImportPolicy::Overwrite;
+	return config;
+}
+
+// Single quad in the XZ plane.
+static pxr::UsdGeomMesh CreateQuad(pxr::UsdStageRefPtr stage, const pxr::SdfPath &path) {
+	auto mesh = pxr::UsdGeomMesh::Define(stage, path);
+	mesh.CreatePointsAttr().Set(pxr::VtVec3fArray{{0.f, 0.f, 0.f}, {0.f, 0.f, 1.f}, {1.f, 0.f, 1.f}, {1.f, 0.f, 0.f}});
+	mesh.CreateFaceVertexCountsAttr().Set(pxr::VtIntArray{4});
+	mesh.CreateFaceVertexIndicesAttr().Set(pxr::VtIntArray{0, 1, 2, 3});
+	return mesh;
+}
+
+// Names of the nodes of a JSON scene, in the order they were created.
+static std::vector<std::string> GetSceneNodeNames(const std::string &path) {
+	std::vector<std::string> names;
+	std::ifstream file(path);
+	if (!file)
+		return names;
+
+	const auto js = json::parse(file, nullptr, false);
+	if (js.is_discarded() || !js.contains("nodes"))
+		return names;
+
+	for (const auto &node : js["nodes"])
+		names.push_back(node.value("name", std::string()));
+	return names;
+}
+
+// Resource names of the instances of a JSON scene.
+static std::vector<std::string> GetSceneInstanceNames(const std::string &path) {
+	std::vector<std::string> names;
+	std::ifstream file(path);
+	if (!file)
+		return names;
+
+	const auto js = json::parse(file, nullptr, false);
+	if (js.is_discarded() || !js.contains("instances"))
+		return names;
+
+	for (const auto &instance : js["instances"])
+		names.push_back(instance.value("name", std::string()));
+	return names;
+}
+
+static std::vector<std::string> ImportNodeNames(const pxr::SdfLayerRefPtr &layer, bool stream_payloads, const std::string &out_path) {
+	auto config = GetTestConfig(out_path);
+	config.stream_payloads = stream_payloads;
+
+	const auto stage = pxr::UsdStage::Open(layer, stream_payloads ? pxr::UsdStage::LoadNone : pxr::UsdStage::LoadAll);
+	ResetImportState();
+	if (!stage || !ImportUSDStage(stage, config.name, config))
+		return {};
+	return GetSceneNodeNames(out_path + "/" + config.name + ".scn");
+}
+
+// A streamed import loads each payload in turn, including a payload nested in another one, and must export the same nodes and instances as a
+// full load.
+static bool TestPayloadStreaming() {
+	auto inner_layer = pxr::SdfLayer::CreateAnonymous("inner.usda");
+	{
+		auto stage = pxr::UsdStage::Open(inner_layer);
+		auto inner = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Inner"));
+		CreateQuad(stage, pxr::SdfPath("/Inner/InnerMesh"));
+		stage->SetDefaultPrim(inner.GetPrim());
+	}
+
+	auto outer_layer = pxr::SdfLayer::CreateAnonymous("outer.usda");
+	{
+		auto stage = pxr::UsdStage::Open(outer_layer);
+		auto outer = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Outer"));
+		CreateQuad(stage, pxr::SdfPath("/Outer/OuterMesh"));
+		pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Outer/Nested")).GetPrim().GetPayloads().AddPayload(inner_layer->GetIdentifier());
+		CreateQuad(stage, pxr::SdfPath("/Outer/AfterNested"));
+		auto instance = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Outer/Instance")).GetPrim();
+		instance.GetReferences().AddReference(inner_layer->GetIdentifier());
+		instance.SetInstanceable(true);
+		stage->SetDefaultPrim(outer.GetPrim());
+	}
+
+	auto root_layer = pxr::SdfLayer::CreateAnonymous("root.usda");
+	{
+		auto stage = pxr::UsdStage::Open(root_layer);
+		pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/World"));
+		CreateQuad(stage, pxr::SdfPath("/World/Before"));
+		pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/World/Payload")).GetPrim().GetPayloads().AddPayload(outer_layer->GetIdentifier());
+		CreateQuad(stage, pxr::SdfPath("/World/After"));
+		for (const auto path : {"/World/InstanceA", "/World/InstanceB"}) {
+			auto instance = pxr::UsdGeomXform::Define(stage, pxr::SdfPath(path)).GetPrim();
+			instance.GetReferences().AddReference(inner_layer->GetIdentifier());
+			instance.SetInstanceable(true);
+		}
+	}
+
+	const auto loaded_path = GetTestOutputPath("payload_loaded"), streamed_path = GetTestOutputPath("payload_streamed");
+	const auto loaded = ImportNodeNames(root_layer, false, loaded_path);
+	const auto streamed = ImportNodeNames(root_layer, true, streamed_path);
+
+	TEST_CHECK(std::find(loaded.begin(), loaded.end(), "InnerMesh") != loaded.end());
+	TEST_CHECK(std::find(loaded.begin(), loaded.end(), "AfterNested") != loaded.end());
+	TEST_CHECK(streamed == loaded);
+
+	// the prototype scenes are named the same whether the payloads are streamed or not
+	auto loaded_instances = GetSceneInstanceNames(loaded_path + "/test.scn");
+	auto streamed_instances = GetSceneInstanceNames(streamed_path + "/test.scn");
+	std::sort(loaded_instances.begin(), loaded_instances.end());
+	std::sort(streamed_instances.begin(), streamed_instances.end());
+	TEST_CHECK(loaded_instances.size() == 3);
+	TEST_CHECK(streamed_instances == loaded_instances);
+	return true;
+}
+
+// At rest, the joints are at their bind transform and a skinned vertex must be where the geometry bind transform puts it, whatever its weights.
+static bool TestSkinBindPose() {
+	auto stage = pxr::UsdStage::CreateInMemory();
+	pxr::UsdGeomSetStageMetersPerUnit(stage, 1.0);
+	pxr::UsdSkelRoot::Define(stage, pxr::SdfPath("/Root"));
+
+	pxr::GfMatrix4d root_bind, arm_bind, geom_bind;
+	root_bind.SetTranslate(pxr::GfVec3d(1, 0, 0));
+	arm_bind.SetTransform(pxr::GfRotation(pxr::GfVec3d(0, 0, 1), 90), pxr::GfVec3d(1, 2, 0));
+	geom_bind.SetTransform(pxr::GfRotation(pxr::GfVec3d(1, 0, 0), 30), pxr::GfVec3d(0, 0, 3));
+
+	auto skeleton = pxr::UsdSkelSkeleton::Define(stage, pxr::SdfPath("/Root/Skeleton"));
+	skeleton.CreateJointsAttr().Set(pxr::VtTokenArray{pxr::TfToken("Hip"), pxr::TfToken("Hip/Arm")});
+	skeleton.CreateBindTransformsAttr().Set(pxr::VtMatrix4dArray{root_bind, arm_bind});
+	skeleton.CreateRestTransformsAttr().Set(pxr::VtMatrix4dArray{root_bind, arm_bind * root_bind.GetInverse()}); // local to the parent joint
+
+	auto mesh = CreateQuad(stage, pxr::SdfPath("/Root/Mesh"));
+	auto binding = pxr::UsdSkelBindingAPI::Apply(mesh.GetPrim());
+	binding.CreateSkeletonRel().SetTargets({skeleton.GetPath()});
+	binding.CreateGeomBindTransformAttr().Set(geom_bind);
+	binding.CreateJointIndicesPrimvar(false, 2).Set(pxr::VtIntArray{0, 0, 1, 1, 0, 1, 1, 0});
+	binding.CreateJointWeightsPrimvar(false, 2).Set(pxr::VtFloatArray{1.f, 0.f, 1.f, 0.f, 0.5f, 0.5f, 0.25f, 0.75f});
+
+	const auto config = GetTestConfig(GetTestOutputPath("skin_bind_pose"));
+	ResetImportState();
+	BindSkelRoot(stage->GetPrimAtPath(pxr::SdfPath("/Root")));
+
+	const auto skin = FindSkinBinding(mesh.GetPrim());
+	TEST_CHECK(skin);
+
+	MeshSource source;
+	ReadMeshSource(mesh.GetPrim(), {}, skin.get(), source);
+	TEST_CHECK(source.skin.size() == source.points.size());
+	TEST_CHECK(source.bindPose.size() == 2);
+
+	hg::Scene scene;
+	auto node = scene.CreateNode("Skeleton");
+	node.SetTransform(scene.CreateTransform());
+	ExportSkeleton(skeleton.GetPrim(), node, scene, config);
+
+	const auto &joints = scene_skeletons[&scene].joints[skeleton.GetPath()];
+	TEST_CHECK(joints.size() == 2);
+
+	scene.ReadyWorldMatrices();
+	scene.ComputeWorldMatrices();
+
+	std::vector<hg::Mat4> geom_bind_mat;
+	ConvertInstanceTransforms(pxr::VtMatrix4dArray{geom_bind}, 1.f, geom_bind_mat);
+
+	for (size_t i = 0; i < source.points.size(); ++i) {
+		const hg::Vec3 point(source.points[i][0], source.points[i][1], source.points[i][2]);
+
+		hg::Vec3 skinned(0, 0, 0);
+		for (int k = 0; k < 4; ++k) {
+			auto joint = scene.GetNode(joints[source.skin[i].index[k]]);
+			const auto bone = joint.GetTransform().GetWorld() * source.bindPose[source.skin[i].index[k]]; // bone matrix of the renderer
+			skinned += bone * point * (source.skin[i].weight[k] / 255.f);
+		}
+
+		TEST_CHECK(hg::Len(skinned - geom_bind_mat[0] * point) < 1e-4f);
+	}
+	return true;
+}
+
+// Irregular grid mesh, the points are moved by xform (row vector convention) and stored as floats as an authored copy would be.
+static pxr::UsdGeomMesh CreateRock(pxr::UsdStageRefPtr stage, const pxr::SdfPath &path, const pxr::GfMatrix4d &xform) {
+	const int size = 24;
+	const double *m = xform.data();
+
+	pxr::VtVec3fArray points;
+	pxr::VtIntArray counts, indices;
+	for (int z = 0; z < size; ++z)
+		for (int x = 0; x < size; ++x) {
+			const double p[3] = {x * 0.1, std::sin(x * 1.3) * std::cos(z * 0.7) * 0.25 + (x * z % 7) * 0.01, z * 0.1};
+			points.push_back(pxr::GfVec3f(float(p[0] * m[0] + p[1] * m[4] + p[2] * m[8] + m[12]), float(p[0] * m[1] + p[1] * m[5] + p[2] * m[9] + m[13]),
+				float(p[0] * m[2] + p[1] * m[6] + p[2] * m[10] + m[14])));
+		}
+	for (int z = 0; z < size - 1; ++z)
+		for (int x = 0; x < size - 1; ++x) {
+			counts.push_back(4);
+			for (const int i : {z * size + x, (z + 1) * size + x, (z + 1) * size + x + 1, z * size + x + 1})
+				indices.push_back(i);
+		}
+
+	auto mesh = pxr::UsdGeomMesh::Define(stage, path);
+	mesh.CreatePointsAttr().Set(points);
+	mesh.CreateFaceVertexCountsAttr().Set(counts);
+	mesh.CreateFaceVertexIndicesAttr().Set(indices);
+	return mesh;
+}
+
+// A rotated and translated copy of a mesh, far from the origin, shares the geometry of the original and is placed by its offset. A copy with
+// a single moved point does not.
+static bool TestRigidGeometryInstances() {
+	auto stage = pxr::UsdStage::CreateInMemory();
+	pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/World"));
+
+	pxr::GfMatrix4d origin, moved;
+	origin.SetTranslate(pxr::GfVec3d(120, 3, -75));
+	moved.SetTransform(pxr::GfRotation(pxr::GfVec3d(1, 2, 3), 37), pxr::GfVec3d(-310, 42, 515));
+
+	const auto rock = CreateRock(stage, pxr::SdfPath("/World/Rock"), origin);
+	const auto copy = CreateRock(stage, pxr::SdfPath("/World/Copy"), origin * moved);
+	const auto other = CreateRock(stage, pxr::SdfPath("/World/Other"), origin * moved);
+	{
+		pxr::VtVec3fArray points;
+		other.GetPointsAttr().Get(&points);
+		points[100][1] += 0.01f;
+		other.GetPointsAttr().Set(points);
+	}
+
+	MeshSource rock_source, copy_source, other_source;
+	ReadMeshSource(rock.GetPrim(), {}, nullptr, rock_source);
+	ReadMeshSource(copy.GetPrim(), {}, nullptr, copy_source);
+	ReadMeshSource(other.GetPrim(), {}, nullptr, other_source);
+
+	GeometryInstanceSource rock_instance, copy_instance, other_instance;
+	bool rock_rigid = true, copy_rigid = true, other_rigid = true;
+	const auto key = ComputeGeometryInstanceKey(rock_source, rock_rigid, rock_instance);
+	TEST_CHECK(ComputeGeometryInstanceKey(copy_source, copy_rigid, copy_instance) == key);
+	TEST_CHECK(ComputeGeometryInstanceKey(other_source, other_rigid, other_instance) == key);
+	TEST_CHECK(rock_rigid && copy_rigid && other_rigid);
+	TEST_CHECK(IsSameGeometryInstance(rock_instance, copy_instance, true));
+	TEST_CHECK(!IsSameGeometryInstance(rock_instance, other_instance, true));
+
+	const auto offset = GetRigidOffset(rock_instance.frame, copy_instance.frame, 1.f);
+	for (size_t i = 0; i < rock_source.points.size(); ++i) {
+		const auto &a = rock_source.points[i], &b = copy_source.points[i];
+		TEST_CHECK(hg::Len(offset * hg::Vec3(a[0], a[1], a[2]) - hg::Vec3(b[0], b[1], b[2])) < 1e-3f);
+	}
+
+	const auto out_path = GetTestOutputPath("rigid_geometry_instances");
+	auto config = GetTestConfig(out_path);
+	config.detect_geometry_instances = true;
+
+	ResetImportState();
+	TEST_CHECK(ImportUSDStage(stage, config.name, config));
+
+	int geo_count = 0;
+	for (const auto &entry : std::filesystem::recursive_directory_iterator(out_path))
+		if (entry.path().extension() == ".geo")
+			++geo_count;
+	TEST_CHECK(geo_count == 2);
+	return true;
+}
+
+// A point instancer prototype authored outside of the instancer is only exported to its prototype scene, and the instance arrays of the
+// instancer are listed next to the scene.
+static bool TestInstancerPrototypes() {
+	auto stage = pxr::UsdStage::CreateInMemory();
+	pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/World"));
+	pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/World/Prototypes"));
+	CreateQuad(stage, pxr::SdfPath("/World/Prototypes/Tree"));
+
+	auto instancer = pxr::UsdGeomPointInstancer::Define(stage, pxr::SdfPath("/World/Forest"));
+	instancer.CreatePrototypesRel().SetTargets({pxr::SdfPath("/World/Prototypes/Tree")});
+	instancer.CreateProtoIndicesAttr().Set(pxr::VtIntArray{0, 0, 0});
+	instancer.CreatePositionsAttr().Set(pxr::VtVec3fArray{{0.f, 0.f, 0.f}, {2.f, 0.f, 0.f}, {4.f, 0.f, 0.f}});
+
+	const auto out_path = GetTestOutputPath("instancer_prototypes");
+	auto config = GetTestConfig(out_path);
+	config.instancer_arrays = true;
+
+	ResetImportState();
+	TEST_CHECK(ImportUSDStage(stage, config.name, config));
+
+	const auto names = GetSceneNodeNames(out_path + "/" + config.name + ".scn");
+	TEST_CHECK(std::find(names.begin(), names.end(), "Forest") != names.end());
+	TEST_CHECK(std::find(names.begin(), names.end(), "Tree") == names.end());
+
+	std::ifstream file(out_path + "/" + config.name + ".instances.json");
+	const auto list = json::parse(file, nullptr, false);
+	TEST_CHECK(!list.is_discarded() && list.contains("instancers") && list["instancers"].size() == 1);
+	TEST_CHECK(list["instancers"][0].value("node", std::string()) == "/World/Forest");
+
+	const auto instances = list["instancers"][0].value("instances", std::string());
+	TEST_CHECK(std::filesystem::exists(out_path + "/" + instances));
+	return true;
+}
+
+static std::vector<std::string> ImportIncremental(const pxr::UsdStageRefPtr &stage, Config config) {
+	config.incremental = true;
+	ResetImportState();
+	if (!ImportUSDStage(stage, config.name, config))
+		return {};
+	return GetSceneNodeNames(config.base_output_path + "/" + config.name + ".scn");
+}
+
+// An incremental import patches the scene of the previous run with the changed, added and removed prims, and replaces it when the options
+// changed.
+static bool TestIncrementalPatch() {
+	auto stage = pxr::UsdStage::CreateInMemory();
+	pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/World"));
+	CreateQuad(stage, pxr::SdfPath("/World/Kept"));
+	CreateQuad(stage, pxr::SdfPath("/World/Changed"));
+	CreateQuad(stage, pxr::SdfPath("/World/Removed"));
+
+	const auto out_path = GetTestOutputPath("incremental_patch");
+	auto config = GetTestConfig(out_path);
+
+	const auto load_manifest = [&]() {
+		std::ifstream file(out_path + "/" + config.name + ".import.json");
+		return json::parse(file, nullptr, false);
+	};
+
+	auto names = ImportIncremental(stage, config);
+	TEST_CHECK(names.size() == 4);
+
+	const auto previous = load_manifest();
+	TEST_CHECK(!previous.is_discarded() && previous.contains("prims"));
+
+	pxr::UsdGeomMesh(stage->GetPrimAtPath(pxr::SdfPath("/World/Changed")))
+		.GetPointsAttr()
+		.Set(pxr::VtVec3fArray{{0.f, 0.f, 0.f}, {0.f, 0.f, 2.f}, {2.f, 0.f, 2.f}, {2.f, 0.f, 0.f}});
+	stage->RemovePrim(pxr::SdfPath("/World/Removed"));
+	CreateQuad(stage, pxr::SdfPath("/World/Added"));
+
+	names = ImportIncremental(stage, config);
+	std::sort(names.begin(), names.end());
+	TEST_CHECK((names == std::vector<std::string>{"Added", "Changed", "Kept", "World"}));
+
+	// the root layer changed but the composed content of the kept prims did not
+	const auto manifest = load_manifest();
+	TEST_CHECK(!manifest.is_discarded() && manifest.value("patchable", false));
+	TEST_CHECK(manifest["prims"].contains("/World/Added") && !manifest["prims"].contains("/World/Removed"));
+	TEST_CHECK(manifest["prims"]["/World"]["content"] == previous["prims"]["/World"]["content"]);
+	TEST_CHECK(manifest["prims"]["/World/Kept"]["content"] == previous["prims"]["/World/Kept"]["content"]);
+	TEST_CHECK(manifest["prims"]["/World/Changed"]["content"] != previous["prims"]["/World/Changed"]["content"]);
+
+	config.exclude_paths = {pxr::SdfPath("/World/Kept")};
+	names = ImportIncremental(stage, config);
+	TEST_CHECK(names.size() == 3 && std::find(names.begin(), names.end(), "Kept") == names.end());
+	return true;
+}
+
+//
+int main(int argc, const char **argv) {
+	hg::set_log_hook(
+		[](const char *msg, int mask, const char *details, void *user) {
+			if (!(mask & (hg::LL_Error | hg::LL_Warning)))
+				return;
+
+			std::lock_guard<std::mutex> guard(log_mutex);
+			std::cout << msg << std::endl;
+		},
+		nullptr);
+	hg::set_log_level(hg::LL_All);
+
+	const std::vector<std::pair<std::string, bool (*)()>> tests = {
+		{"payload_streaming", TestPayloadStreaming},
+		{"skin_bind_pose", TestSkinBindPose},
+		{"instancer_prototypes", TestInstancerPrototypes},
+		{"rigid_geometry_instances", TestRigidGeometryInstances},
+		{"incremental_patch", TestIncrementalPatch},
+	};
+
+	int run = 0, failed = 0;
+	for (const auto &test : tests) {
+		if (argc > 1 && test.first != argv[1])
+			continue;
+
+		++run;
+		const bool passed = test.second();
+		std::cout << (passed ? "PASS " : "FAIL ") << test.first << std::endl;
+		failed += passed ? 0 : 1;
+	}
+	if (!run)
+		std::cout << "Unknown test '" << argv[1] << "'" << std::endl;
+	return failed || !run ? EXIT_FAILURE : EXIT_SUCCESS;
+}